@@ -0,0 +1,97 @@
+//===============================
+// ColumnWriter
+// Per-field binary column files for telemetry captures.
+//===============================
+
+#include "ColumnWriter.h"
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+
+namespace {
+
+enum ColumnIndex {
+  COL_SEQ,
+  COL_TIME,
+  COL_VALS,
+  COL_PREDICT,
+  COL_DEVIATION,
+  COL_MOTOR_L,
+  COL_MOTOR_R,
+  COL_DECISION,
+  COL_FLAGS,
+  COL_COUNT,
+};
+
+const char* const columnNames[COL_COUNT] = {
+  "seq.u8",
+  "time_us.u32",
+  "vals.u16x5",
+  "predict.u16",
+  "deviation.i16",
+  "motor_l.i16",
+  "motor_r.i16",
+  "decision.u8",
+  "flags.u8",
+};
+
+const size_t FILE_BUFFER = 1 << 20; //per column, keeps writes large
+
+} // namespace
+
+ColumnWriter::ColumnWriter() : count(0) {}
+
+ColumnWriter::~ColumnWriter() {
+  close();
+}
+
+bool ColumnWriter::open(const std::string& dir) {
+  close();
+  if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) {
+    fprintf(stderr, "%s: %s\n", dir.c_str(), strerror(errno));
+    return false;
+  }
+  for (size_t i = 0; i < COL_COUNT; i++) {
+    std::string path = dir + "/" + columnNames[i];
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file) {
+      fprintf(stderr, "%s: %s\n", path.c_str(), strerror(errno));
+      close();
+      return false;
+    }
+    setvbuf(file, NULL, _IOFBF, FILE_BUFFER);
+    columns.push_back({columnNames[i], file});
+  }
+  count = 0;
+  return true;
+}
+
+void ColumnWriter::put(size_t column, const void* data, size_t bytes) {
+  fwrite(data, 1, bytes, columns[column].file);
+}
+
+void ColumnWriter::add(const TelemetryFrame& frame) {
+  put(COL_SEQ, &frame.seq, sizeof(frame.seq));
+  put(COL_TIME, &frame.timeUs, sizeof(frame.timeUs));
+  put(COL_VALS, frame.vals, sizeof(frame.vals));
+  put(COL_PREDICT, &frame.predict, sizeof(frame.predict));
+  put(COL_DEVIATION, &frame.deviation, sizeof(frame.deviation));
+  put(COL_MOTOR_L, &frame.motorL, sizeof(frame.motorL));
+  put(COL_MOTOR_R, &frame.motorR, sizeof(frame.motorR));
+  put(COL_DECISION, &frame.decision, sizeof(frame.decision));
+  put(COL_FLAGS, &frame.flags, sizeof(frame.flags));
+  count++;
+}
+
+void ColumnWriter::flush() {
+  for (Column& column : columns) {
+    fflush(column.file);
+  }
+}
+
+void ColumnWriter::close() {
+  for (Column& column : columns) {
+    fclose(column.file);
+  }
+  columns.clear();
+}
@@ -0,0 +1,53 @@
+//===============================
+// ColumnWriter
+// Writes decoded telemetry frames as one flat binary file per field,
+// each a plain array in host byte order (little-endian on x86 and ARM
+// Linux), so any of them can be memory-mapped on its own:
+//
+//   seq.u8  time_us.u32  vals.u16x5  predict.u16  deviation.i16
+//   motor_l.i16  motor_r.i16  decision.u8  flags.u8
+//
+// Row i of every file is frame i. vals holds the five sensors of a row
+// next to each other. numpy.memmap(path, dtype, mode="r") reads a
+// column; vals reshapes to (-1, 5).
+//===============================
+
+#ifndef COLUMN_WRITER_H
+#define COLUMN_WRITER_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <Telemetry.h>
+
+class ColumnWriter {
+public:
+  ColumnWriter();
+  ~ColumnWriter();
+
+  //Creates dir if needed and opens every column there, truncated.
+  //Returns false with a message on stderr if anything fails.
+  bool open(const std::string& dir);
+
+  void add(const TelemetryFrame& frame);
+
+  //Pushes buffered rows to the files, e.g. before a status report.
+  void flush();
+  void close();
+
+  uint64_t rows() const {return count;}
+
+private:
+  struct Column {
+    const char* name;
+    FILE* file;
+  };
+
+  void put(size_t column, const void* data, size_t bytes);
+
+  std::vector<Column> columns;
+  uint64_t count;
+};
+
+#endif
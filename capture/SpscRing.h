@@ -0,0 +1,84 @@
+//===============================
+// SpscRing
+// Lock-free byte ring between exactly one producer thread and one
+// consumer thread. Each side owns one index and only reads the other's,
+// with acquire/release ordering, so neither ever waits on a lock. The
+// indices sit on their own cache lines so the two cores do not fight
+// over one line on every update.
+//===============================
+
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <vector>
+
+class SpscRing {
+public:
+  //capacity is rounded up to a power of two
+  explicit SpscRing(size_t capacity) {
+    size_t size = 1;
+    while (size < capacity) {
+      size <<= 1;
+    }
+    buffer.resize(size);
+    mask = size - 1;
+  }
+
+  //Producer: copies up to n bytes in, returns how many fitted.
+  size_t write(const uint8_t* data, size_t n) {
+    size_t head = writeIndex.load(std::memory_order_relaxed);
+    size_t tail = readIndex.load(std::memory_order_acquire);
+    size_t room = buffer.size() - (head - tail);
+    if (n > room) {
+      n = room;
+    }
+    copyIn(head, data, n);
+    writeIndex.store(head + n, std::memory_order_release);
+    return n;
+  }
+
+  //Consumer: copies up to n bytes out, returns how many there were.
+  size_t read(uint8_t* data, size_t n) {
+    size_t tail = readIndex.load(std::memory_order_relaxed);
+    size_t head = writeIndex.load(std::memory_order_acquire);
+    if (n > head - tail) {
+      n = head - tail;
+    }
+    copyOut(tail, data, n);
+    readIndex.store(tail + n, std::memory_order_release);
+    return n;
+  }
+
+  //Bytes waiting, as seen from either side.
+  size_t used() const {
+    return writeIndex.load(std::memory_order_acquire) - readIndex.load(std::memory_order_acquire);
+  }
+
+  size_t capacity() const {return buffer.size();}
+
+private:
+  void copyIn(size_t at, const uint8_t* data, size_t n) {
+    size_t start = at & mask;
+    size_t first = n < buffer.size() - start ? n : buffer.size() - start;
+    memcpy(&buffer[start], data, first);
+    memcpy(&buffer[0], data + first, n - first);
+  }
+
+  void copyOut(size_t at, uint8_t* data, size_t n) {
+    size_t start = at & mask;
+    size_t first = n < buffer.size() - start ? n : buffer.size() - start;
+    memcpy(data, &buffer[start], first);
+    memcpy(data + first, &buffer[0], n - first);
+  }
+
+  std::vector<uint8_t> buffer;
+  size_t mask;
+  alignas(64) std::atomic<size_t> writeIndex{0}; //free-running, wraps with size_t
+  alignas(64) std::atomic<size_t> readIndex{0};
+};
+
+#endif
@@ -0,0 +1,255 @@
+//===============================
+// capture
+// Records the robot's line-control telemetry (lib/Telemetry) from its
+// USB serial port into per-field column files, see ColumnWriter.h.
+// A reader thread does nothing but move bytes from the port into a
+// lock-free ring; the main thread decodes frames and writes the
+// columns. A slow disk write therefore only fills the ring and never
+// stalls the port. The ring holds minutes of stream at full rate.
+//
+// Build and run with PlatformIO:
+//   pio run -e capture
+//   .pio/build/capture/program /dev/ttyACM0 run1
+//
+// The input can also be a file or FIFO holding a raw stream, which is
+// replayed as fast as it can be read. A serial port is switched to raw
+// mode and sent "tele on" at the start and "tele off" at the end.
+// Stops on Ctrl-C or at the end of the input.
+//
+// Options:
+//   --raw FILE     also keep the raw byte stream, for replays
+//   --ring MB      ring size (64)
+//===============================
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <Telemetry.h>
+#include "ColumnWriter.h"
+#include "SpscRing.h"
+
+namespace {
+
+std::atomic<bool> stopRequested{false};
+
+void onSignal(int) {
+  stopRequested.store(true);
+}
+
+void usage() {
+  fprintf(stderr, "usage: capture [--raw FILE] [--ring MB] PORT|FILE DIR\n");
+  exit(2);
+}
+
+//Raw 8-bit mode, no echo or line editing. The rate does not matter on
+//the 32U4's USB serial but is set for real UARTs.
+bool makeRaw(int fd) {
+  termios tio;
+  if (tcgetattr(fd, &tio) != 0) {
+    return false;
+  }
+  cfmakeraw(&tio);
+  cfsetispeed(&tio, B115200);
+  cfsetospeed(&tio, B115200);
+  tio.c_cflag |= CLOCAL | CREAD;
+  tio.c_cc[VMIN] = 0;
+  tio.c_cc[VTIME] = 0;
+  return tcsetattr(fd, TCSANOW, &tio) == 0;
+}
+
+void sendLine(int fd, const char* line) {
+  if (write(fd, line, strlen(line)) < 0) {
+    perror("write");
+  }
+}
+
+struct ReaderStats {
+  std::atomic<uint64_t> bytes{0};
+  std::atomic<uint64_t> stalls{0}; //ring full, port read held back
+  std::atomic<bool> done{false};
+};
+
+//Producer: port -> ring, optionally teed to raw. Only waits for input
+//or, with the ring full, for the consumer.
+void readPort(int fd, SpscRing& ring, FILE* raw, ReaderStats& stats) {
+  static uint8_t chunk[1 << 16];
+  pollfd pfd = {fd, POLLIN, 0};
+  while (!stopRequested.load()) {
+    if (poll(&pfd, 1, 100) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("poll");
+      break;
+    }
+    ssize_t n = read(fd, chunk, sizeof(chunk));
+    if (n < 0) {
+      if (errno == EAGAIN || errno == EINTR) {
+        continue;
+      }
+      perror("read");
+      break;
+    }
+    if (n == 0) {
+      if (isatty(fd)) {
+        continue;
+      }
+      break; //end of a replayed file
+    }
+    if (raw) {
+      fwrite(chunk, 1, n, raw);
+    }
+    size_t sent = 0;
+    while (sent < (size_t)n) {
+      size_t put = ring.write(chunk + sent, n - sent);
+      sent += put;
+      if (sent < (size_t)n) {
+        stats.stalls++;
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+      }
+    }
+    stats.bytes += n;
+  }
+  stats.done.store(true);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  const char* rawPath = NULL;
+  size_t ringMb = 64;
+  const char* input = NULL;
+  const char* dir = NULL;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--raw") == 0 && i + 1 < argc) {
+      rawPath = argv[++i];
+    }
+    else if (strcmp(argv[i], "--ring") == 0 && i + 1 < argc) {
+      ringMb = strtoul(argv[++i], NULL, 10);
+    }
+    else if (argv[i][0] == '-') {
+      usage();
+    }
+    else if (!input) {
+      input = argv[i];
+    }
+    else if (!dir) {
+      dir = argv[i];
+    }
+    else {
+      usage();
+    }
+  }
+  if (!input || !dir || ringMb == 0) {
+    usage();
+  }
+
+  int fd = open(input, O_RDWR | O_NOCTTY);
+  if (fd < 0) {
+    fd = open(input, O_RDONLY);
+  }
+  if (fd < 0) {
+    perror(input);
+    return 1;
+  }
+  bool port = isatty(fd);
+  if (port && !makeRaw(fd)) {
+    perror("tcsetattr");
+    return 1;
+  }
+
+  ColumnWriter columns;
+  if (!columns.open(dir)) {
+    return 1;
+  }
+  FILE* raw = NULL;
+  if (rawPath) {
+    raw = fopen(rawPath, "wb");
+    if (!raw) {
+      perror(rawPath);
+      return 1;
+    }
+  }
+
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+  if (port) {
+    sendLine(fd, "tele on\n");
+  }
+
+  SpscRing ring(ringMb << 20);
+  ReaderStats stats;
+  std::thread reader(readPort, fd, std::ref(ring), raw, std::ref(stats));
+
+  //Consumer: ring -> decoder -> columns
+  TelemetryDecoder decoder;
+  static uint8_t chunk[1 << 16];
+  uint64_t dropped = 0; //seq gaps: frames the robot could not send
+  bool haveSeq = false;
+  uint8_t nextSeq = 0;
+  size_t ringPeak = 0;
+  auto lastReport = std::chrono::steady_clock::now();
+  uint64_t lastRows = 0;
+  while (true) {
+    size_t used = ring.used();
+    if (used > ringPeak) {
+      ringPeak = used;
+    }
+    size_t n = ring.read(chunk, sizeof(chunk));
+    if (n == 0) {
+      if (stats.done.load() && ring.used() == 0) {
+        break;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    for (size_t i = 0; i < n; i++) {
+      if (!decoder.push(chunk[i])) {
+        continue;
+      }
+      const TelemetryFrame& frame = decoder.frame();
+      if (haveSeq) {
+        dropped += (uint8_t)(frame.seq - nextSeq);
+      }
+      haveSeq = true;
+      nextSeq = frame.seq + 1;
+      columns.add(frame);
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    if (now - lastReport >= std::chrono::seconds(1)) {
+      columns.flush();
+      fprintf(stderr, "\rframes %llu (%llu/s)  robot drops %llu  bad %u  ring %zu%% peak %zu%%  stalls %llu   ",
+              (unsigned long long)columns.rows(),
+              (unsigned long long)(columns.rows() - lastRows),
+              (unsigned long long)dropped, decoder.badFrames(),
+              used * 100 / ring.capacity(), ringPeak * 100 / ring.capacity(),
+              (unsigned long long)stats.stalls.load());
+      lastReport = now;
+      lastRows = columns.rows();
+    }
+  }
+  reader.join();
+
+  if (port) {
+    sendLine(fd, "tele off\n");
+  }
+  close(fd);
+  if (raw) {
+    fclose(raw);
+  }
+  columns.close();
+  fprintf(stderr, "\n%llu frames, %llu bytes, %llu dropped by the robot, %u bad, ring peak %zu bytes\n",
+          (unsigned long long)columns.rows(), (unsigned long long)stats.bytes.load(),
+          (unsigned long long)dropped, decoder.badFrames(), ringPeak);
+  return 0;
+}
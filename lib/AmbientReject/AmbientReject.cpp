@@ -0,0 +1,76 @@
+//===============================
+// AmbientReject
+// Emitter on/off differential line sensor reads.
+//===============================
+
+#include "AmbientReject.h"
+
+static const uint16_t NO_AMBIENT = 0xFFFF;
+
+AmbientReject::AmbientReject() {
+  for (uint8_t i = 0; i < SENSOR_COUNT; i++) {
+    ambient[i] = NO_AMBIENT;
+  }
+  resetCalibration();
+}
+
+void AmbientReject::resetCalibration() {
+  for (uint8_t i = 0; i < SENSOR_COUNT; i++) {
+    minimum[i] = 0xFFFF;
+    maximum[i] = 0;
+  }
+  calibratedOnce = false;
+}
+
+void AmbientReject::setAmbient(const uint16_t* off, uint16_t offTimeout) {
+  for (uint8_t i = 0; i < SENSOR_COUNT; i++) {
+    ambient[i] = off[i] < offTimeout ? off[i] : NO_AMBIENT;
+  }
+}
+
+void AmbientReject::subtract(uint16_t* vals, uint16_t timeout) const {
+  for (uint8_t i = 0; i < SENSOR_COUNT; i++) {
+    if (ambient[i] >= timeout) {
+      continue;
+    }
+    //on + (timeout - off): the discharge time ambient light took away
+    uint32_t v = (uint32_t)vals[i] + (timeout - ambient[i]);
+    vals[i] = v > timeout ? timeout : v;
+  }
+}
+
+void AmbientReject::calibrate(const uint16_t* vals) {
+  for (uint8_t i = 0; i < SENSOR_COUNT; i++) {
+    if (vals[i] < minimum[i]) {minimum[i] = vals[i];}
+    if (vals[i] > maximum[i]) {maximum[i] = vals[i];}
+  }
+  calibratedOnce = true;
+}
+
+void AmbientReject::calibrated(uint16_t* vals) const {
+  for (uint8_t i = 0; i < SENSOR_COUNT; i++) {
+    if (maximum[i] <= minimum[i]) {
+      vals[i] = 0;
+      continue;
+    }
+    int32_t v = ((int32_t)vals[i] - minimum[i]) * 1000 / (maximum[i] - minimum[i]);
+    if (v < 0) {v = 0;}
+    if (v > 1000) {v = 1000;}
+    vals[i] = v;
+  }
+}
+
+void AmbientReject::getCalibration(uint16_t* minimum, uint16_t* maximum) const {
+  for (uint8_t i = 0; i < SENSOR_COUNT; i++) {
+    minimum[i] = this->minimum[i];
+    maximum[i] = this->maximum[i];
+  }
+}
+
+void AmbientReject::setCalibration(const uint16_t* minimum, const uint16_t* maximum) {
+  for (uint8_t i = 0; i < SENSOR_COUNT; i++) {
+    this->minimum[i] = minimum[i];
+    this->maximum[i] = maximum[i];
+  }
+  calibratedOnce = true;
+}
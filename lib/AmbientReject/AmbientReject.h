@@ -0,0 +1,56 @@
+//===============================
+// AmbientReject
+// Removes ambient infrared from the line sensor reads. An emitters-off
+// read measures how much the room light alone shortens each sensor's
+// discharge time; that shortening is added back to the emitters-on read
+// (the same on/off differential as Pololu's QTR OnAndOff mode), so only
+// the emitters' reflection is left. The result is calibrated to 0..1000
+// against its own minima and maxima, like LineSensors::readCalibrated.
+//
+// The off read may use a shorter timeout than the on read: a sensor that
+// does not discharge within it is taken as seeing no ambient light.
+// Integer only, no Arduino headers.
+//===============================
+
+#ifndef AMBIENT_REJECT_H
+#define AMBIENT_REJECT_H
+
+#include <stdint.h>
+
+class AmbientReject {
+public:
+  static const uint8_t SENSOR_COUNT = 5;
+
+  AmbientReject();
+
+  //Forgets the calibration minima and maxima.
+  void resetCalibration();
+
+  //Stores an emitters-off read taken with a timeout of offTimeout (us).
+  void setAmbient(const uint16_t* off, uint16_t offTimeout);
+
+  //Emitters-on read taken with timeout (us) -> ambient-free raw values,
+  //in place, still 0..timeout.
+  void subtract(uint16_t* vals, uint16_t timeout) const;
+
+  //Widens the calibration range with one ambient-free raw read.
+  void calibrate(const uint16_t* vals);
+
+  //Ambient-free raw values -> 0 (most reflective) .. 1000, in place.
+  void calibrated(uint16_t* vals) const;
+
+  bool isCalibrated() const {return calibratedOnce;}
+
+  //Calibration minima and maxima, SENSOR_COUNT each, to keep a
+  //calibration across resets and put it back without a spin.
+  void getCalibration(uint16_t* minimum, uint16_t* maximum) const;
+  void setCalibration(const uint16_t* minimum, const uint16_t* maximum);
+
+private:
+  uint16_t ambient[SENSOR_COUNT];  //off read, 0xFFFF = none seen
+  uint16_t minimum[SENSOR_COUNT];
+  uint16_t maximum[SENSOR_COUNT];
+  bool calibratedOnce;
+};
+
+#endif
@@ -0,0 +1,55 @@
+//===============================
+// DoubleBuffer
+// Hands a small struct from one execution context to another (the
+// foreground loop and an interrupt handler) without locks. The writer
+// fills the buffer the reader is not using and flips a one-byte index,
+// which is an atomic store on the AVR. A publish counter lets a reader
+// that can be preempted by the writer detect a copy that straddled a
+// publish and retry it.
+//
+// One writer and one reader per buffer. Header only, no Arduino headers.
+//===============================
+
+#ifndef DOUBLE_BUFFER_H
+#define DOUBLE_BUFFER_H
+
+#include <stdint.h>
+
+template <typename T>
+class DoubleBuffer {
+public:
+  DoubleBuffer() : front(0), seq(0) {}
+
+  //Writer side: makes value the one readers see from now on.
+  void write(const T& value) {
+    uint8_t back = front ^ 1;
+    slots[back] = value;
+    barrier();
+    front = back;
+    seq = seq + 1;
+  }
+
+  //Reader side: copies the last written value. Never blocks the writer;
+  //retries only if a write landed while copying.
+  void read(T& out) const {
+    uint8_t s;
+    do {
+      s = seq;
+      barrier();
+      out = slots[front];
+      barrier();
+    } while (s != seq);
+  }
+
+  //Number of writes so far (wraps at 256).
+  uint8_t writes() const {return seq;}
+
+private:
+  static void barrier() {asm volatile("" ::: "memory");}
+
+  T slots[2];
+  volatile uint8_t front;
+  volatile uint8_t seq;
+};
+
+#endif
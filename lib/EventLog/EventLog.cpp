@@ -0,0 +1,50 @@
+//===============================
+// EventLog
+// Fixed-size circular flight recorder of intersection events.
+//===============================
+
+#include "EventLog.h"
+
+EventLog::EventLog() {
+  clear();
+}
+
+void EventLog::clear() {
+  head = 0;
+  added = 0;
+}
+
+void EventLog::add(const IntersectionEvent& event) {
+  events[head] = event;
+  head++;
+  if (head == CAPACITY) {
+    head = 0;
+  }
+  if (added < 0xFFFF) {
+    added++;
+  }
+}
+
+uint8_t EventLog::count() const {
+  if (added < CAPACITY) {
+    return added;
+  }
+  return CAPACITY;
+}
+
+uint16_t EventLog::total() const {
+  return added;
+}
+
+const IntersectionEvent& EventLog::get(uint8_t index) const {
+  //before the log wraps the oldest event is at 0, after it is at head
+  uint8_t start = 0;
+  if (added >= CAPACITY) {
+    start = head;
+  }
+  uint8_t slot = start + index;
+  if (slot >= CAPACITY) {
+    slot -= CAPACITY;
+  }
+  return events[slot];
+}
@@ -0,0 +1,61 @@
+//===============================
+// EventLog
+// Fixed-size circular flight recorder of intersection events.
+// Oldest events are overwritten once the log is full.
+// No Arduino headers.
+//===============================
+
+#ifndef EVENT_LOG_H
+#define EVENT_LOG_H
+
+#include <stdint.h>
+
+//Event flag bits
+enum EventFlags : uint8_t {
+  EVENT_LEFT = 0x01,     //leftMem
+  EVENT_CENTER = 0x02,   //centerMem
+  EVENT_RIGHT = 0x04,    //rightMem
+  EVENT_FORCED = 0x08,   //forced turn, not recorded
+  EVENT_RECORDED = 0x10, //stored in the decision history
+  EVENT_FINISH = 0x20,   //finish detected here
+  EVENT_OPT_RUN = 0x40,  //logged during the optimized run
+  EVENT_SLIP = 0x80,     //wheel slip since the previous event
+};
+
+struct IntersectionEvent {
+  uint32_t time;      //ms since run start, at detection
+  int16_t distance;   //mm since run start, at detection
+  char decision;
+  uint8_t flags;
+  uint16_t straightMs; //line following up to detection
+  uint16_t probeMs;    //crawl, align and sensor checks
+  uint16_t ruleMs;     //search rule evaluation
+  uint16_t turnMs;     //turn and stop
+};
+
+class EventLog {
+public:
+  //The last few junctions are what a crash dump needs; 16 B each.
+  static const uint8_t CAPACITY = 12;
+
+  EventLog();
+
+  void clear();
+  void add(const IntersectionEvent& event);
+
+  //Events currently held, at most CAPACITY.
+  uint8_t count() const;
+
+  //Events added since clear(), including overwritten ones.
+  uint16_t total() const;
+
+  //0 is the oldest event still held.
+  const IntersectionEvent& get(uint8_t index) const;
+
+private:
+  IntersectionEvent events[CAPACITY];
+  uint8_t head;
+  uint16_t added;
+};
+
+#endif
@@ -0,0 +1,78 @@
+//===============================
+// FixedPoint
+// Table-driven trigonometry and integer roots.
+//===============================
+
+#include "FixedPoint.h"
+
+#ifdef __AVR__
+#include <avr/pgmspace.h>
+#else
+#define PROGMEM
+#define pgm_read_word(addr) (*(addr))
+#endif
+
+namespace fx {
+
+//sin(i * 90 / 64 deg) in Q14, i = 0..64
+static const int16_t quarterSine[65] PROGMEM = {
+  0, 402, 804, 1205, 1606, 2006, 2404, 2801,
+  3196, 3590, 3981, 4370, 4756, 5139, 5520, 5897,
+  6270, 6639, 7005, 7366, 7723, 8076, 8423, 8765,
+  9102, 9434, 9760, 10080, 10394, 10702, 11003, 11297,
+  11585, 11866, 12140, 12406, 12665, 12916, 13160, 13395,
+  13623, 13842, 14053, 14256, 14449, 14635, 14811, 14978,
+  15137, 15286, 15426, 15557, 15679, 15791, 15893, 15986,
+  16069, 16143, 16207, 16261, 16305, 16340, 16364, 16379,
+  16384,
+};
+
+int16_t sinQ14(uint16_t brad) {
+  uint8_t quadrant = brad >> 14;
+  uint16_t offset = brad & 0x3FFF;
+  //mirror the 2nd and 4th quadrants onto the table
+  if (quadrant & 1) {
+    offset = 0x4000 - offset;
+  }
+
+  //64 table steps of 256 brad each
+  uint8_t index = offset >> 8;
+  int16_t frac = offset & 0xFF;
+  int16_t a = (int16_t)pgm_read_word(&quarterSine[index]);
+  int16_t value = a;
+  if (index < 64) {
+    int16_t b = (int16_t)pgm_read_word(&quarterSine[index + 1]);
+    value = a + (int16_t)(((int32_t)(b - a) * frac) >> 8);
+  }
+
+  if (quadrant & 2) {
+    return -value;
+  }
+  return value;
+}
+
+int16_t cosQ14(uint16_t brad) {
+  return sinQ14(brad + 0x4000);
+}
+
+//Bit-by-bit method, no multiplies or divides
+uint16_t isqrt32(uint32_t x) {
+  uint32_t root = 0;
+  uint32_t bit = 1UL << 30;
+  while (bit > x) {
+    bit >>= 2;
+  }
+  while (bit != 0) {
+    if (x >= root + bit) {
+      x -= root + bit;
+      root = (root >> 1) + bit;
+    }
+    else {
+      root >>= 1;
+    }
+    bit >>= 2;
+  }
+  return (uint16_t)root;
+}
+
+} // namespace fx
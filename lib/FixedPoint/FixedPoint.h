@@ -0,0 +1,208 @@
+//===============================
+// FixedPoint
+// Integer-only kinematics and unit conversions for the 3pi+ 32U4.
+// The ATmega32U4 has no FPU, so every scale factor is folded into an
+// integer Q-format constant at compile time and the hot path only does
+// integer multiplies and shifts.
+//
+// Does not depend on any Arduino header.
+//===============================
+
+#ifndef FIXED_POINT_H
+#define FIXED_POINT_H
+
+#include <stdint.h>
+
+namespace fx {
+
+//==================== Drivetrain Constants =======================
+//Only used inside constant expressions, never at runtime.
+constexpr double ENC_CPR = 12.0;        //encoder counts per motor revolution
+constexpr double GEAR_RATIO = 29.86;    //3pi+ Standard Edition gearmotors
+constexpr double WHEEL_DIAM_MM = 32.0;
+constexpr double TRACK_MM = 89.0;       //wheel contact spacing, nominal; tune with a 10-turn spin
+constexpr double MM_PER_SEC_AT_400 = 1500.0; //free-running speed at full command, nominal battery
+constexpr double LINE_PITCH_MM = 15.0;  //line sensor spacing, 1000 position units
+constexpr double SENSOR_AHEAD_MM = 30.0; //line sensor row ahead of the axle
+constexpr double PI_D = 3.14159265358979;
+
+constexpr double TICKS_PER_REV = ENC_CPR * GEAR_RATIO;
+constexpr double MM_PER_TICK = PI_D * WHEEL_DIAM_MM / TICKS_PER_REV;
+
+//==================== Q-Format Helpers ===========================
+//Rounds a real constant to a Qn integer. Use only in constant expressions.
+constexpr int32_t toQ(double x, uint8_t bits) {
+  return (int32_t)(x * (double)(1UL << bits) + (x < 0 ? -0.5 : 0.5));
+}
+
+//Rounding multiply of an integer by a Qn constant.
+constexpr int32_t mulQ(int32_t x, int32_t q, uint8_t bits) {
+  return (x * q + (1L << (bits - 1))) >> bits;
+}
+
+//Q8 shortcut for small gains and ratios (motor speed clamps, etc.)
+constexpr int16_t Q8(double x) {
+  return (int16_t)toQ(x, 8);
+}
+
+constexpr int16_t mulQ8(int16_t x, int16_t q8) {
+  return (int16_t)mulQ(x, q8, 8);
+}
+
+//==================== Scale Factors (Q16) ========================
+constexpr int32_t DEG_PER_TICK_Q16 = toQ(360.0 / TICKS_PER_REV, 16);
+constexpr int32_t TICKS_PER_DEG_Q16 = toQ(TICKS_PER_REV / 360.0, 16);
+constexpr int32_t MM_PER_TICK_Q16 = toQ(MM_PER_TICK, 16);
+constexpr int32_t TICKS_PER_MM_Q16 = toQ(1.0 / MM_PER_TICK, 16);
+constexpr int32_t UM_PER_TICK = toQ(MM_PER_TICK * 1000.0, 0);
+
+//Motor command units (-400..400) and wheel speed at nominal battery
+constexpr int32_t MM_PER_SEC_PER_MOTOR_Q8 = toQ(MM_PER_SEC_AT_400 / 400.0, 8);
+constexpr int16_t MOTOR_PER_MM_PER_SEC_Q8 = (int16_t)toQ(400.0 / MM_PER_SEC_AT_400, 8);
+
+//Angles are binary angles (brad): 65536 brad = 360 deg, so wrap-around
+//is free in uint16_t/int16_t arithmetic.
+//Heading change per tick of right-minus-left wheel difference.
+constexpr int32_t BRAD_PER_TICK_DIFF_Q8 = toQ(MM_PER_TICK / TRACK_MM * 65536.0 / (2.0 * PI_D), 8);
+
+//Path curvature is in 1/m, Q8 (256 = 1 m radius, positive = left).
+//Curvature times mm travelled per tick of right-minus-left difference.
+constexpr int32_t CURV_Q8_MM_PER_TICK_DIFF = toQ(MM_PER_TICK / TRACK_MM * 1000.0, 8);
+//Half the track in m, the per-wheel speed offset per unit of curvature.
+constexpr int32_t HALF_TRACK_M_Q16 = toQ(TRACK_MM / 2000.0, 16);
+//Line position units the line moves across the sensor row per tick of
+//right-minus-left difference, the robot turning under a still line.
+constexpr int32_t LINE_UNITS_PER_TICK_DIFF_Q8 = toQ(MM_PER_TICK / TRACK_MM * SENSOR_AHEAD_MM * 1000.0 / LINE_PITCH_MM, 8);
+
+//==================== Distance and Angle =========================
+//Wheel rotation in degrees. Valid for |ticks| < 32000.
+constexpr int32_t ticksToDeg(int32_t ticks) {
+  return mulQ(ticks, DEG_PER_TICK_Q16, 16);
+}
+
+//Valid for |deg| < 32000.
+constexpr int32_t degToTicks(int32_t deg) {
+  return mulQ(deg, TICKS_PER_DEG_Q16, 16);
+}
+
+//Valid for |ticks| < 100000.
+constexpr int32_t ticksToMm(int32_t ticks) {
+  return mulQ(ticks, MM_PER_TICK_Q16, 16);
+}
+
+//Valid for |mm| < 9000.
+constexpr int32_t mmToTicks(int32_t mm) {
+  return mulQ(mm, TICKS_PER_MM_Q16, 16);
+}
+
+//Valid for |deg| < 32000.
+constexpr int32_t degToBrad(int32_t deg) {
+  return mulQ(deg, toQ(65536.0 / 360.0, 8), 8);
+}
+
+constexpr int16_t bradToDeg(int16_t brad) {
+  return (int16_t)mulQ(brad, toQ(360.0 / 65536.0, 16), 16);
+}
+
+//Heading in brad from the accumulated right-minus-left tick difference.
+//Valid for |diffTicks| < 250000.
+constexpr uint16_t diffTicksToBrad(int32_t diffTicks) {
+  return (uint16_t)mulQ(diffTicks, BRAD_PER_TICK_DIFF_Q8, 8);
+}
+
+//==================== Trigonometry ===============================
+//Sine and cosine of a binary angle in Q14 (16384 = 1.0), from a
+//quarter-wave table with linear interpolation. Error < 0.0003.
+int16_t sinQ14(uint16_t brad);
+int16_t cosQ14(uint16_t brad);
+
+//==================== Roots ======================================
+//Integer square root, rounded down.
+uint16_t isqrt32(uint32_t x);
+
+//==================== Speed ======================================
+//Wheel speed in mm/s from ticks counted over dtMs milliseconds.
+//um per ms is mm per s. Valid for |ticks| < 7000.
+constexpr int32_t ticksToMmPerSec(int32_t ticks, uint16_t dtMs) {
+  return dtMs == 0 ? 0 : ticks * UM_PER_TICK / dtMs;
+}
+
+//Motor command units to nominal wheel speed in mm/s and back.
+constexpr int16_t motorToMmPerSec(int16_t speed) {
+  return (int16_t)mulQ(speed, MM_PER_SEC_PER_MOTOR_Q8, 8);
+}
+
+constexpr int16_t mmPerSecToMotor(int16_t mmPerSec) {
+  return (int16_t)mulQ(mmPerSec, MOTOR_PER_MM_PER_SEC_Q8, 8);
+}
+
+//Ticks expected over dtMs milliseconds at mmPerSec.
+constexpr int32_t mmPerSecToTicks(int32_t mmPerSec, uint16_t dtMs) {
+  return mmPerSec * dtMs / UM_PER_TICK;
+}
+
+//==================== Curvature ==================================
+//Limits x to the int16_t range.
+constexpr int16_t saturate16(int32_t x) {
+  return (int16_t)(x > 32767 ? 32767 : x < -32767 ? -32767 : x);
+}
+
+//Path curvature in 1/m Q8 from the right-minus-left tick difference over
+//mm travelled. Saturates at +-32767, a radius under 8 mm (near a
+//pivot). Valid for |diffTicks| < 2000.
+constexpr int16_t curvatureQ8(int32_t diffTicks, int16_t mm) {
+  return mm == 0 ? 0 : saturate16(diffTicks * CURV_Q8_MM_PER_TICK_DIFF / mm);
+}
+
+//Line position units (1000 per sensor) to mm, positive = line to the left.
+constexpr int16_t lineOffsetMm(int16_t deviation) {
+  return (int16_t)(-(int32_t)deviation * (int32_t)(LINE_PITCH_MM + 0.5) / 1000);
+}
+
+//Offset of each wheel from speed, in the same units, that makes the
+//robot follow curvature curvQ8. Left wheel speed - offset, right + offset.
+constexpr int16_t curveWheelOffset(int16_t speed, int16_t curvQ8) {
+  return (int16_t)(((int32_t)speed * curvQ8 / 256 * HALF_TRACK_M_Q16) >> 16);
+}
+
+//==================== Time =======================================
+constexpr uint32_t msToUs(uint32_t ms) {
+  return ms * 1000UL;
+}
+
+constexpr uint32_t usToMs(uint32_t us) {
+  return (us + 500UL) / 1000UL;
+}
+
+//==================== Error Bounds ===============================
+//Checked by the compiler on every build, host or target.
+constexpr int32_t absDiff(int32_t a, int32_t b) {
+  return a > b ? a - b : b - a;
+}
+
+//one wheel revolution is 358.32 ticks, 360 deg and 100.5 mm
+static_assert(absDiff(ticksToDeg(358), 360) <= 1, "ticksToDeg scale");
+static_assert(absDiff(ticksToDeg(-3583), -3600) <= 1, "ticksToDeg sign");
+static_assert(absDiff(ticksToDeg(30000), 30141) <= 1, "ticksToDeg range");
+static_assert(absDiff(degToTicks(3600), 3583) <= 1, "degToTicks scale");
+static_assert(absDiff(ticksToMm(3583), 1005) <= 1, "ticksToMm scale");
+static_assert(absDiff(ticksToMm(100000), 28056) <= 2, "ticksToMm range");
+static_assert(absDiff(mmToTicks(1005), 3583) <= 2, "mmToTicks scale");
+static_assert(absDiff(ticksToMmPerSec(36, 10), 1010) <= 2, "ticksToMmPerSec");
+static_assert(absDiff(mmPerSecToTicks(1000, 10), 35) <= 1, "mmPerSecToTicks");
+static_assert(degToBrad(90) == 16384, "degToBrad scale");
+static_assert(bradToDeg(-16384) == -90, "bradToDeg sign");
+static_assert(absDiff(motorToMmPerSec(400), 1500) <= 1, "motorToMmPerSec");
+static_assert(absDiff(mmPerSecToMotor(1500), 400) <= 2, "mmPerSecToMotor");
+static_assert(mulQ8(60, Q8(0.7)) == 42, "Q8 clamp ratio");
+static_assert(mulQ8(400, Q8(0.7)) == 280, "Q8 clamp ratio range");
+static_assert(absDiff(curvatureQ8(317, 100), 2560) <= 10, "curvatureQ8, 100 mm radius");
+static_assert(curvatureQ8(-317, 100) < 0, "curvatureQ8 sign");
+static_assert(curvatureQ8(-1999, 10) == -32767, "curvatureQ8 saturates");
+static_assert(lineOffsetMm(-1000) == 15, "lineOffsetMm");
+static_assert(absDiff(LINE_UNITS_PER_TICK_DIFF_Q8, 1614) <= 2, "line shift per tick difference");
+static_assert(absDiff(curveWheelOffset(400, 2560), 178) <= 1, "curveWheelOffset");
+
+} // namespace fx
+
+#endif
@@ -0,0 +1,157 @@
+//===============================
+// GainTuner
+// Coordinate-descent search of line follower Kp/Kd gains.
+//===============================
+
+#include "GainTuner.h"
+
+static const uint32_t NO_COST = 0xFFFFFFFFUL;
+
+GainTuner::GainTuner() {
+  rmsWeight = 2;
+  maxStableRms = 600;
+  kpStep = 16;
+  kdStep = 64;
+  kpStepMin = 4;
+  kdStepMin = 16;
+  finished = true;
+  count = 0;
+}
+
+void GainTuner::start(int16_t speed, uint16_t kp, uint16_t kd, int16_t step, int16_t max) {
+  curSpeed = speed;
+  speedStep = step;
+  maxSpeed = max;
+  bestKp = kp;
+  bestKd = kd;
+  count = 0;
+  finished = false;
+  startSpeed();
+}
+
+//Begins a search at curSpeed from the current best gains
+void GainTuner::startSpeed() {
+  bestCost = NO_COST;
+  baseDone = false;
+  step[0] = kpStep;
+  step[1] = kdStep;
+  coord = 0;
+  dir = 1;
+  trials = 0;
+  candKp = bestKp;
+  candKd = bestKd;
+}
+
+int16_t GainTuner::speed() const {
+  return curSpeed;
+}
+
+uint16_t GainTuner::kp() const {
+  return candKp;
+}
+
+uint16_t GainTuner::kd() const {
+  return candKd;
+}
+
+bool GainTuner::done() const {
+  return finished;
+}
+
+uint8_t GainTuner::resultCount() const {
+  return count;
+}
+
+const GainSet& GainTuner::result(uint8_t index) const {
+  return results[index];
+}
+
+void GainTuner::report(const TrialResult& result) {
+  if (finished) {
+    return;
+  }
+  trials++;
+
+  uint32_t cost = NO_COST;
+  if (result.stable && result.rms <= maxStableRms) {
+    cost = (uint32_t)result.rms * rmsWeight + result.timeMs;
+  }
+
+  if (!baseDone) {
+    baseDone = true;
+    bestCost = cost;
+  }
+  else if (cost < bestCost) {
+    //keep going the same way
+    bestCost = cost;
+    bestKp = candKp;
+    bestKd = candKd;
+  }
+  else {
+    failDirection();
+  }
+
+  if (converged() || trials >= MAX_TRIALS) {
+    finishSpeed();
+    return;
+  }
+  nextCandidate();
+}
+
+//Tries the other side, then a finer step on the other gain
+void GainTuner::failDirection() {
+  if (dir > 0) {
+    dir = -1;
+    return;
+  }
+  dir = 1;
+  step[coord] /= 2;
+  coord ^= 1;
+}
+
+bool GainTuner::converged() const {
+  return step[0] < kpStepMin && step[1] < kdStepMin;
+}
+
+//Picks the next valid candidate around the best gains
+void GainTuner::nextCandidate() {
+  while (!converged()) {
+    int32_t kp = bestKp;
+    int32_t kd = bestKd;
+    if (coord == 0) {
+      kp += dir * (int32_t)step[0];
+    }
+    else {
+      kd += dir * (int32_t)step[1];
+    }
+    //a step of zero or below zero gain is not worth a trial
+    if (step[coord] > 0 && kp >= 0 && kd >= 0 && kp <= 0xFFFF && kd <= 0xFFFF) {
+      candKp = kp;
+      candKd = kd;
+      return;
+    }
+    failDirection();
+  }
+  finishSpeed();
+}
+
+//Stores this speed's result and moves to the next speed
+void GainTuner::finishSpeed() {
+  if (bestCost == NO_COST) {
+    //nothing stable at this speed, stop here
+    finished = true;
+    return;
+  }
+  if (count < MAX_SPEEDS) {
+    results[count].speed = curSpeed;
+    results[count].kp = bestKp;
+    results[count].kd = bestKd;
+    count++;
+  }
+  curSpeed += speedStep;
+  if (curSpeed > maxSpeed || count >= MAX_SPEEDS) {
+    finished = true;
+    return;
+  }
+  startSpeed();
+}
@@ -0,0 +1,83 @@
+//===============================
+// GainTuner
+// Coordinate-descent search of line follower Kp/Kd gains, stepping the
+// motor speed up each time the search converges. The caller runs one
+// trial per candidate and reports its lap time and tracking error.
+// No Arduino headers.
+//===============================
+
+#ifndef GAIN_TUNER_H
+#define GAIN_TUNER_H
+
+#include <stdint.h>
+
+struct GainSet {
+  int16_t speed;
+  uint16_t kp;
+  uint16_t kd;
+};
+
+struct TrialResult {
+  uint16_t timeMs; //time to cover the trial distance
+  uint16_t rms;    //RMS line deviation over the trial
+  bool stable;     //false if the line was lost
+};
+
+class GainTuner {
+public:
+  static const uint8_t MAX_SPEEDS = 8;
+  static const uint8_t MAX_TRIALS = 30; //per speed
+
+  GainTuner();
+
+  void start(int16_t speed, uint16_t kp, uint16_t kd, int16_t speedStep, int16_t maxSpeed);
+
+  //Candidate for the next trial
+  int16_t speed() const;
+  uint16_t kp() const;
+  uint16_t kd() const;
+
+  void report(const TrialResult& result);
+  bool done() const;
+
+  //Best stable gains found, one per speed, increasing speed.
+  uint8_t resultCount() const;
+  const GainSet& result(uint8_t index) const;
+
+  //cost = rms * rmsWeight + timeMs
+  uint8_t rmsWeight;
+  uint16_t maxStableRms;
+  uint16_t kpStep;
+  uint16_t kdStep;
+  uint16_t kpStepMin;
+  uint16_t kdStepMin;
+
+private:
+  void startSpeed();
+  void nextCandidate();
+  void failDirection();
+  bool converged() const;
+  void finishSpeed();
+
+  int16_t curSpeed;
+  int16_t speedStep;
+  int16_t maxSpeed;
+
+  uint16_t bestKp;
+  uint16_t bestKd;
+  uint32_t bestCost;
+  bool baseDone;
+
+  uint16_t step[2];
+  uint8_t coord; //0 = Kp, 1 = Kd
+  int8_t dir;
+  uint16_t candKp;
+  uint16_t candKd;
+  uint8_t trials;
+  bool finished;
+
+  GainSet results[MAX_SPEEDS];
+  uint8_t count;
+};
+
+#endif
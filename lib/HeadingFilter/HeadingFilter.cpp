@@ -0,0 +1,95 @@
+//===============================
+// HeadingFilter
+// Gyro + encoder heading estimate.
+//===============================
+
+#include "HeadingFilter.h"
+#include <FixedPoint.h>
+
+//0.07 dps per LSB, in 1/65536 brad per (LSB * us)
+static const int32_t GYRO_SCALE_Q16 = fx::toQ(0.07 * 65536.0 / 360.0 * 1e-6 * 65536.0, 16);
+static const uint16_t MAX_DT_US = 50000;
+static const int32_t SLIP_LIMIT = (int32_t)16384 << 16; //90 deg
+//largest wheel tick difference the encoder increment holds in int32;
+//far beyond what 50 ms of driving gives
+static const int32_t MAX_TICK_DIFF = 0x7FFFFFFF / (fx::BRAD_PER_TICK_DIFF_Q8 * 256);
+
+HeadingFilter::HeadingFilter() {
+  encoderWeight = 16;
+  biasQ4 = 0;
+  startCalibration();
+  reset();
+}
+
+void HeadingFilter::startCalibration() {
+  biasSum = 0;
+  biasSamples = 0;
+}
+
+void HeadingFilter::addCalibrationSample(int16_t gyroZ) {
+  biasSum += gyroZ;
+  biasSamples++;
+}
+
+void HeadingFilter::finishCalibration() {
+  if (biasSamples > 0) {
+    biasQ4 = (int16_t)(biasSum * 16 / biasSamples);
+  }
+}
+
+void HeadingFilter::reset() {
+  angle = 0;
+  encAngle = 0;
+  slip = 0;
+}
+
+void HeadingFilter::update(int16_t gyroZ, uint16_t dtUs, int16_t dL, int16_t dR) {
+  if (dtUs > MAX_DT_US) {
+    dtUs = MAX_DT_US;
+  }
+
+  //gyro increment, rate kept in 1/16 LSB so the bias fraction is not lost.
+  //The rate takes 20 bits and dt times the scale 22, so the product is
+  //summed from the top and the low 10 bits of the rate in 32 bits.
+  int32_t rateQ4 = (int32_t)gyroZ * 16 - biasQ4;
+  int32_t stepQ10 = (int32_t)(((uint32_t)dtUs * GYRO_SCALE_Q16) >> 10);
+  int32_t gyroDelta = (rateQ4 >> 10) * stepQ10
+    + (int32_t)(((uint32_t)(rateQ4 & 1023) * stepQ10) >> 10);
+
+  //encoder increment in the same units
+  int32_t diff = (int32_t)dR - dL;
+  if (diff > MAX_TICK_DIFF) {diff = MAX_TICK_DIFF;}
+  if (diff < -MAX_TICK_DIFF) {diff = -MAX_TICK_DIFF;}
+  int32_t encDelta = diff * fx::BRAD_PER_TICK_DIFF_Q8 * 256;
+
+  //complementary filter: the gyro carries the heading from sample to
+  //sample and every update moves it part of the way to the encoder
+  //heading, which has no bias, so gyro drift stays bounded
+  encAngle += (uint32_t)encDelta;
+  angle += (uint32_t)gyroDelta;
+  int32_t error = (int32_t)(encAngle - angle);
+  angle += (uint32_t)((error >> 8) * encoderWeight);
+
+  //their difference, leaking by dt / SLIP_LEAK_US, kept within +-90 deg
+  int32_t leakQ16 = (int32_t)((uint32_t)dtUs * 65536 / SLIP_LEAK_US);
+  slip += encDelta - gyroDelta;
+  slip -= (slip >> 16) * leakQ16;
+  if (slip > SLIP_LIMIT) {slip = SLIP_LIMIT;}
+  if (slip < -SLIP_LIMIT) {slip = -SLIP_LIMIT;}
+}
+
+uint16_t HeadingFilter::heading() const {
+  return (uint16_t)(angle >> 16);
+}
+
+int16_t HeadingFilter::bias() const {
+  return biasQ4;
+}
+
+int16_t HeadingFilter::slipAngle() const {
+  return (int16_t)(slip >> 16);
+}
+
+void HeadingFilter::clearSlipAngle() {
+  slip = 0;
+}
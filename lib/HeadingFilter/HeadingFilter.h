@@ -0,0 +1,59 @@
+//===============================
+// HeadingFilter
+// Gyro + encoder heading estimate. The gyro z rate is integrated for
+// short-term accuracy and the result is pulled toward the heading the
+// encoder differential gives, so gyro bias leaves a bounded offset
+// rather than a growing drift. Integer only, no Arduino headers, so it
+// can be fed recorded or simulated samples on the host.
+//===============================
+
+#ifndef HEADING_FILTER_H
+#define HEADING_FILTER_H
+
+#include <stdint.h>
+
+class HeadingFilter {
+public:
+  HeadingFilter();
+
+  //Gyro bias calibration. Robot must be standing still.
+  void startCalibration();
+  void addCalibrationSample(int16_t gyroZ);
+  void finishCalibration();
+
+  //Sets the heading to 0 without touching the bias.
+  void reset();
+
+  //gyroZ: raw z rate (0.07 dps/LSB, 2000 dps full scale)
+  //dtUs:  time since the previous update, capped at 50 ms
+  //dL/dR: encoder ticks since the previous update; a difference too
+  //large to be driving is clamped
+  void update(int16_t gyroZ, uint16_t dtUs, int16_t dL, int16_t dR);
+
+  //Binary angle, 65536 = 360 deg, counter-clockwise positive.
+  uint16_t heading() const;
+
+  //Calibrated gyro offset in 1/16 LSB.
+  int16_t bias() const;
+
+  //Encoder minus gyro heading change, brad, leaking away over about
+  //SLIP_LEAK_US. The two agree while the wheels grip; a wheel sliding
+  //on the floor turns the encoders but not the robot.
+  int16_t slipAngle() const;
+  void clearSlipAngle();
+
+  static const uint32_t SLIP_LEAK_US = 100000;
+
+  //Share of the gap to the encoder heading closed per update, Q8.
+  uint8_t encoderWeight;
+
+private:
+  uint32_t angle;    //heading in 1/65536 brad
+  uint32_t encAngle; //encoder heading, same units
+  int32_t slip;   //1/65536 brad
+  int32_t biasSum;
+  uint16_t biasSamples;
+  int16_t biasQ4;
+};
+
+#endif
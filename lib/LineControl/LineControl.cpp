@@ -0,0 +1,73 @@
+//===============================
+// LineControl
+// Line follower steering and bend speed, see LineControl.h.
+//===============================
+
+#include "LineControl.h"
+#include <FixedPoint.h>
+
+static int16_t clamp16(int32_t v, int16_t lo, int16_t hi) {
+  return v < lo ? lo : (v > hi ? hi : v);
+}
+
+LineControl::LineControl() {
+  lastDev = 0;
+}
+
+void LineControl::reset(const LineGains& gains, int16_t countsL, int16_t countsR) {
+  lastDev = 0;
+  estimator.reset();
+  estimator.alphaQ8 = gains.estAlphaQ8;
+  estimator.betaQ8 = gains.estBetaQ8;
+  curvature.reset(countsL, countsR);
+}
+
+LineCommand LineControl::step(const LineGains& gains, int16_t measured, bool onLine, uint32_t sampleUs,
+    uint32_t nowUs, int16_t countsL, int16_t countsR) {
+  LineCommand cmd;
+  int16_t deviation = measured;
+  int16_t change = deviation - lastDev;
+  if (gains.estAlphaQ8 > 0 && onLine) {
+    //offset when this command takes effect, rate per line period
+    estimator.update(measured, sampleUs, countsL, countsR);
+    deviation = estimator.offsetAt(nowUs - sampleUs + gains.leadUs);
+    change = estimator.rate() * gains.periodMs / 1000;
+  }
+  else {
+    estimator.reset();
+  }
+  //the console allows gains that take this far past 16 bits
+  int32_t adj = deviation * (int32_t)gains.kp / 256 + change * (int32_t)gains.kd / 256;
+  cmd.adj = clamp16(adj, -400, 400);
+  cmd.deviation = deviation;
+  lastDev = deviation;
+
+  //Curvature feed-forward: bend speed, and each wheel's share of the turn
+  curvature.update(measured, onLine, countsL, countsR);
+  int16_t speed = gains.speed;
+  int16_t offset = 0;
+  if (gains.curveControl) {
+    speed = curveSpeed(gains);
+    offset = fx::mulQ8(fx::curveWheelOffset(speed, curvature.curvature()), gains.ffGainQ8);
+    offset = clamp16(offset, -speed, speed);
+  }
+  int16_t centerL = speed - offset;
+  int16_t centerR = speed + offset;
+
+  //the PID only slows a wheel, down to clampQ8 of its share
+  cmd.left = clamp16((int32_t)centerL + cmd.adj, fx::mulQ8(centerL, gains.clampQ8), centerL);
+  cmd.right = clamp16((int32_t)centerR - cmd.adj, fx::mulQ8(centerR, gains.clampQ8), centerR);
+  return cmd;
+}
+
+int16_t LineControl::curveSpeed(const LineGains& gains) const {
+  uint16_t limit = curvature.speedLimit(gains.latAcc);
+  int16_t speed = gains.speed;
+  if (limit < (uint16_t)fx::motorToMmPerSec(gains.speed)) {
+    speed = fx::mmPerSecToMotor(limit);
+  }
+  if (speed < gains.minSpeed) {
+    speed = gains.minSpeed < gains.speed ? gains.minSpeed : gains.speed;
+  }
+  return speed;
+}
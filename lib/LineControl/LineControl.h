@@ -0,0 +1,69 @@
+//===============================
+// LineControl
+// The line follower's control law: PD steering on the line offset,
+// predicted to when the command takes effect by the LineEstimator,
+// and the curvature feed-forward that slows the robot for a bend and
+// gives each wheel its share of the turn. One step per sensor frame
+// gives both wheel speeds; reading the sensors and driving the motors
+// stay with the caller. The sketch and the simulator both run it.
+// Integer only, no Arduino headers.
+//===============================
+
+#ifndef LINE_CONTROL_H
+#define LINE_CONTROL_H
+
+#include <stdint.h>
+#include <LineCurvature.h>
+#include <LineEstimator.h>
+
+//Tunables, in motor units (400 = full speed) where not given
+struct LineGains {
+  int16_t speed;
+  int16_t minSpeed;     //floor of the bend speed limit
+  int16_t kp;           //Q8, per position unit
+  int16_t kd;           //Q8, per position unit of change per period
+  int16_t clampQ8;      //lowest share of its speed the PID leaves a wheel
+  bool curveControl;    //bend speed limit and feed-forward
+  int16_t latAcc;       //mm/s^2, bend speed limit
+  int16_t ffGainQ8;     //share of the modelled wheel offset fed forward
+  int16_t estAlphaQ8;   //LineEstimator weights, 0 = raw reads
+  int16_t estBetaQ8;
+  int16_t leadUs;       //command to wheels
+  int16_t periodMs;     //line loop period
+};
+
+//Outcome of one step
+struct LineCommand {
+  int16_t left;      //wheel speeds
+  int16_t right;
+  int16_t adj;       //PID steering, before the wheel clamp
+  int16_t deviation; //offset steered on
+};
+
+class LineControl {
+public:
+  LineControl();
+
+  //Clears the PID history and the line and curvature estimates for a
+  //new segment.
+  void reset(const LineGains& gains, int16_t countsL, int16_t countsR);
+
+  //One step on a fresh frame.
+  //measured: line position - midpoint (1000 per sensor, + = right)
+  //sampleUs: time the sensors were read; nowUs: time of this step
+  LineCommand step(const LineGains& gains, int16_t measured, bool onLine, uint32_t sampleUs,
+    uint32_t nowUs, int16_t countsL, int16_t countsR);
+
+  //Offset steered on in the last step, 0 after a reset
+  int16_t lastDeviation() const {return lastDev;}
+
+private:
+  //gains.speed, lowered for the current bend but not below minSpeed
+  int16_t curveSpeed(const LineGains& gains) const;
+
+  int16_t lastDev;
+  LineEstimator estimator;
+  LineCurvature curvature;
+};
+
+#endif
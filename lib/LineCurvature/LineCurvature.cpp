@@ -0,0 +1,93 @@
+//===============================
+// LineCurvature
+// Line curvature estimate for feed-forward and bend speed limits.
+//===============================
+
+#include "LineCurvature.h"
+#include <FixedPoint.h>
+
+LineCurvature::LineCurvature() {
+  windowMm = 20;
+  alphaQ8 = 96;
+  reset(0, 0);
+}
+
+void LineCurvature::reset(int16_t countsL, int16_t countsR) {
+  lastL = countsL;
+  lastR = countsR;
+  windowTicks = 0;
+  windowDiff = 0;
+  offsetSum = 0;
+  offsetCount = 0;
+  prevOffset = 0;
+  prevSlopeQ8 = 0;
+  windows = 0;
+  curv = 0;
+}
+
+void LineCurvature::update(int16_t deviation, bool onLine, int16_t countsL, int16_t countsR) {
+  int16_t dL = countsL - lastL;
+  int16_t dR = countsR - lastR;
+  lastL = countsL;
+  lastR = countsR;
+  windowTicks += dL + dR;
+  windowDiff += dR - dL;
+  if (onLine && offsetCount < 255) {
+    offsetSum += fx::lineOffsetMm(deviation);
+    offsetCount++;
+  }
+
+  int16_t mm = fx::ticksToMm(windowTicks) / 2;
+  if (mm < (int16_t)windowMm) {
+    if (mm < -(int16_t)windowMm) {
+      //backing up, nothing to learn about the line ahead
+      windowTicks = 0;
+      windowDiff = 0;
+    }
+    return;
+  }
+
+  //robot path curvature, plus the line's curvature relative to it
+  int32_t raw = fx::curvatureQ8(windowDiff, mm);
+  if (offsetCount > 0) {
+    int16_t offset = offsetSum / offsetCount;
+    if (windows > 0) {
+      int16_t slopeQ8 = (int32_t)(offset - prevOffset) * 256 / mm;
+      if (windows > 1) {
+        raw += (int32_t)(slopeQ8 - prevSlopeQ8) * 1000 / mm;
+      }
+      prevSlopeQ8 = slopeQ8;
+      windows = 2;
+    }
+    else {
+      windows = 1;
+    }
+    prevOffset = offset;
+  }
+  else {
+    windows = 0;
+  }
+
+  if (raw > 32767) raw = 32767;
+  if (raw < -32767) raw = -32767;
+  curv += ((raw - curv) * alphaQ8) >> 8;
+
+  windowTicks = 0;
+  windowDiff = 0;
+  offsetSum = 0;
+  offsetCount = 0;
+}
+
+int16_t LineCurvature::curvature() const {
+  return curv;
+}
+
+uint16_t LineCurvature::speedLimit(uint16_t latAcc) const {
+  uint16_t k = curv < 0 ? -curv : curv;
+  if (latAcc > 16000) latAcc = 16000;
+  if (k < 16) {
+    return 0xFFFF; //straighter than a 16 m radius
+  }
+  //v^2 = a / k, with k in 1/m Q8 and a in mm/s^2
+  return fx::isqrt32((uint32_t)latAcc * 256000UL / k);
+}
@@ -0,0 +1,50 @@
+//===============================
+// LineCurvature
+// Curvature of the line ahead, estimated over fixed distance windows
+// from the robot's own path curvature (encoder differential) plus how
+// fast the line drifts across the sensor row (second difference of the
+// line offset over distance). Gives the line follower a feed-forward
+// turn and a speed limit for the bend. Integer only, no Arduino headers.
+//===============================
+
+#ifndef LINE_CURVATURE_H
+#define LINE_CURVATURE_H
+
+#include <stdint.h>
+
+class LineCurvature {
+public:
+  LineCurvature();
+
+  //Starts a new estimate, e.g. at the start of a straight segment.
+  //countsL/countsR: current encoder counts.
+  void reset(int16_t countsL, int16_t countsR);
+
+  //Call once per line control step.
+  //deviation: line position - midpoint (1000 per sensor, + = right)
+  //onLine:    false if the sensors lost the line; deviation is ignored
+  void update(int16_t deviation, bool onLine, int16_t countsL, int16_t countsR);
+
+  //Filtered curvature, 1/m Q8, positive = bending left.
+  int16_t curvature() const;
+
+  //Highest speed in mm/s that keeps lateral acceleration at or below
+  //latAcc (mm/s^2, at most 16000) on the current curvature.
+  uint16_t speedLimit(uint16_t latAcc) const;
+
+  uint8_t windowMm;  //distance per estimate
+  uint8_t alphaQ8;   //filter weight of a new estimate
+
+private:
+  int16_t lastL, lastR;
+  int16_t windowTicks; //both wheels summed
+  int16_t windowDiff;  //right minus left
+  int32_t offsetSum;   //mm, over the window's on-line samples
+  uint8_t offsetCount;
+  int16_t prevOffset;  //mm, average over the previous window
+  int16_t prevSlopeQ8; //line angle to the robot path, rad Q8
+  uint8_t windows;     //completed windows with a valid offset, max 2
+  int16_t curv;
+};
+
+#endif
@@ -0,0 +1,65 @@
+//===============================
+// LineEstimator
+// Alpha-beta line offset and rate tracker with latency compensation.
+//===============================
+
+#include "LineEstimator.h"
+#include <FixedPoint.h>
+
+static const int32_t OFFSET_MAX = 2000;  //edge of the sensor row
+static const int32_t RATE_MAX = 60000;   //units/s, whole row in 70 ms
+static const uint32_t LEAD_MAX_US = 10000;
+
+static int32_t clamp(int32_t v, int32_t limit) {
+  if (v > limit) {return limit;}
+  if (v < -limit) {return -limit;}
+  return v;
+}
+
+LineEstimator::LineEstimator() {
+  alphaQ8 = 160;
+  betaQ8 = 32;
+  reset();
+}
+
+void LineEstimator::reset() {
+  started = false;
+  offsetQ8 = 0;
+  drift = 0;
+  turnRate = 0;
+}
+
+void LineEstimator::update(int16_t offset, uint32_t us, int16_t countsL, int16_t countsR) {
+  uint32_t dt = us - lastUs;
+  int16_t diff = (int16_t)(countsR - lastR) - (int16_t)(countsL - lastL);
+  lastUs = us;
+  lastL = countsL;
+  lastR = countsR;
+  if (!started || dt == 0 || dt > MAX_GAP_US) {
+    started = true;
+    offsetQ8 = (int32_t)offset << 8;
+    drift = 0;
+    turnRate = 0;
+    return;
+  }
+
+  //prediction: the line's drift plus the shift of our own turn, which
+  //moves the row under the line (turning left moves the line right)
+  int32_t turnQ8 = (int32_t)diff * fx::LINE_UNITS_PER_TICK_DIFF_Q8;
+  turnRate = clamp((turnQ8 >> 4) * 62500 / (int32_t)dt, RATE_MAX); //Q4 per us -> per s
+  int32_t predicted = offsetQ8 + turnQ8 + drift * (int32_t)dt / 3906; //units/s * us -> Q8
+
+  //correction
+  int32_t residualQ8 = ((int32_t)offset << 8) - predicted;
+  offsetQ8 = clamp(predicted + (residualQ8 * alphaQ8 >> 8), OFFSET_MAX << 8);
+  int32_t perSec = 1000000L / (int32_t)dt;
+  drift = clamp(drift + ((residualQ8 >> 8) * betaQ8 >> 8) * perSec, RATE_MAX);
+}
+
+int16_t LineEstimator::offsetAt(uint32_t leadUs) const {
+  if (leadUs > LEAD_MAX_US) {
+    leadUs = LEAD_MAX_US;
+  }
+  int32_t ahead = rate() * (int32_t)leadUs / 1000000L;
+  return (int16_t)clamp((offsetQ8 >> 8) + ahead, OFFSET_MAX);
+}
@@ -0,0 +1,51 @@
+//===============================
+// LineEstimator
+// Alpha-beta tracker of the line offset under the sensor row and its
+// rate, driven by the actual sample timestamps. The robot's own turning
+// (encoder differential since the last sample) is fed in as a known
+// input, so the tracked rate is only the line's drift across the row,
+// and the offset can be predicted forward to the moment the motor
+// command takes effect rather than the moment the sensors were read.
+// Integer only, no Arduino headers.
+//===============================
+
+#ifndef LINE_ESTIMATOR_H
+#define LINE_ESTIMATOR_H
+
+#include <stdint.h>
+
+class LineEstimator {
+public:
+  static const uint32_t MAX_GAP_US = 20000; //longer between samples starts over
+
+  LineEstimator();
+
+  //Forgets the state; the next update starts from its measurement.
+  void reset();
+
+  //One sensor frame.
+  //offset:  line position - midpoint (1000 per sensor, + = right)
+  //us:      time the sensors were read (micros)
+  //countsL/countsR: encoder counts at that time
+  void update(int16_t offset, uint32_t us, int16_t countsL, int16_t countsR);
+
+  //Offset expected leadUs (at most 10 ms) after the last sample if the
+  //robot keeps turning as it did, clamped to the sensor row (+-2000).
+  int16_t offsetAt(uint32_t leadUs) const;
+
+  //Offset rate in units/s, own turning included.
+  int32_t rate() const {return drift + turnRate;}
+
+  uint8_t alphaQ8; //offset weight of a new measurement
+  uint8_t betaQ8;  //rate weight of a new measurement
+
+private:
+  bool started;
+  uint32_t lastUs;
+  int16_t lastL, lastR;
+  int32_t offsetQ8; //position units Q8
+  int32_t drift;    //units/s, the line moving across the row
+  int32_t turnRate; //units/s, the robot turning under the line
+};
+
+#endif
@@ -0,0 +1,195 @@
+//===============================
+// MazeDecision
+// Hardware-free maze decision engine.
+//===============================
+
+#include "MazeDecision.h"
+
+#ifdef __AVR__
+#include <avr/pgmspace.h>
+#else
+#define PROGMEM
+#define pgm_read_byte(addr) (*(const uint8_t*)(addr))
+#endif
+
+namespace maze {
+
+//==================== Junction Table ============================
+//One entry per junctionCode(): bit 0 left, 1 center, 2 right, 3 finish,
+//4 right hand rule.
+constexpr JunctionAction junctionTable[JUNCTION_CODES] PROGMEM = {
+  //left hand rule
+  {'U', DECISION_RECORDED}, // -
+  {'L', DECISION_FORCED},   // L
+  {'S', DECISION_IGNORED},  // C
+  {'L', DECISION_RECORDED}, // L C
+  {'R', DECISION_FORCED},   // R
+  {'L', DECISION_RECORDED}, // L R
+  {'S', DECISION_RECORDED}, // C R
+  {'L', DECISION_RECORDED}, // L C R
+  //left hand rule, sensors on the finish pad
+  {'U', DECISION_RECORDED},
+  {'L', DECISION_FORCED},
+  {'S', DECISION_IGNORED},
+  {'L', DECISION_RECORDED},
+  {'R', DECISION_FORCED},
+  {'L', DECISION_RECORDED},
+  {'S', DECISION_RECORDED},
+  {'F', DECISION_IGNORED},
+  //right hand rule
+  {'U', DECISION_RECORDED}, // -
+  {'L', DECISION_FORCED},   // L
+  {'S', DECISION_IGNORED},  // C
+  {'S', DECISION_RECORDED}, // L C
+  {'R', DECISION_FORCED},   // R
+  {'R', DECISION_RECORDED}, // L R
+  {'R', DECISION_RECORDED}, // C R
+  {'R', DECISION_RECORDED}, // L C R
+  //right hand rule, sensors on the finish pad
+  {'U', DECISION_RECORDED},
+  {'L', DECISION_FORCED},
+  {'S', DECISION_IGNORED},
+  {'S', DECISION_RECORDED},
+  {'R', DECISION_FORCED},
+  {'R', DECISION_RECORDED},
+  {'R', DECISION_RECORDED},
+  {'F', DECISION_IGNORED},
+};
+
+//The search rules the table encodes, evaluated for every code at
+//compile time. Not used at run time.
+namespace rules {
+
+constexpr bool bit(uint8_t code, uint8_t n) {return (code >> n) & 1;}
+
+//Wall follower: first open branch on the rule's side
+constexpr char handRule(bool l, bool c, bool r, bool rightHand) {
+  return rightHand ? (r ? 'R' : c ? 'S' : l ? 'L' : 'U')
+                   : (l ? 'L' : c ? 'S' : r ? 'R' : 'U');
+}
+
+//A lone right branch is always taken; a U-turn with a right branch open
+//becomes a right turn
+constexpr char overrideRule(char d, bool l, bool c, bool r) {
+  return (!l && !c && r) ? 'R' : (d == 'U' && r) ? 'R' : d;
+}
+
+constexpr char decision(uint8_t code) {
+  return (code & 0x0F) == 0x0F ? 'F'
+       : overrideRule(handRule(bit(code, 0), bit(code, 1), bit(code, 2), bit(code, 4)),
+                  bit(code, 0), bit(code, 1), bit(code, 2));
+}
+
+//Recorded: U-turns, and turns taken where another branch was open.
+//Forced: the only branch. Everything else (straight on with no side
+//branch on the rule's side, the finish) is ignored.
+constexpr DecisionKind classify(char d, bool l, bool c, bool r, bool rh) {
+  return d == 'U' ? DECISION_RECORDED
+       : (d == 'R' && c && r && !l) ? DECISION_RECORDED            // right turns to the right
+       : (d == 'L' && !rh && c && !r && l) ? DECISION_RECORDED     // left turns to the left
+       : (d == 'S' && rh && c && !r && l) ? DECISION_RECORDED      // left turns in right hand mode
+       : (d == 'S' && !rh && c && r && !l) ? DECISION_RECORDED     // right turns in left hand mode
+       : (d == 'L' && l && !c && !r) ? DECISION_FORCED             // forced left turn
+       : (d == 'R' && !l && !c && r) ? DECISION_FORCED             // forced right turn
+       : (d == 'R' && rh && r && l) ? DECISION_RECORDED            // T turns with right hand mode
+       : (d == 'L' && !rh && r && l) ? DECISION_RECORDED           // T turns with left hand mode
+       : DECISION_IGNORED;
+}
+
+constexpr DecisionKind kind(uint8_t code) {
+  return classify(decision(code), bit(code, 0), bit(code, 1), bit(code, 2), bit(code, 4));
+}
+
+constexpr bool tableMatches(uint8_t code) {
+  return code == JUNCTION_CODES
+      || (junctionTable[code].decision == decision(code)
+          && junctionTable[code].kind == kind(code)
+          && tableMatches(code + 1));
+}
+
+} // namespace rules
+
+static_assert(rules::tableMatches(0), "junction table disagrees with the search rules");
+static_assert(junctionCode({true, true, true}, true, true) == JUNCTION_CODES - 1, "junction code range");
+
+JunctionAction junctionAction(uint8_t code) {
+  JunctionAction action;
+  action.decision = pgm_read_byte(&junctionTable[code].decision);
+  action.kind = (DecisionKind)pgm_read_byte(&junctionTable[code].kind);
+  return action;
+}
+
+//==================== Decision History ==========================
+bool storeDecision(char path[], int& count, int capacity, char decision) {
+  if (count + 1 >= capacity) {
+    return false;
+  }
+  count++;
+  path[count] = decision;
+  return true;
+}
+
+//Replacement for the detour a, U, b, or 0 if it is not one
+static char reduce(char a, char b) {
+  if (a == 'S' && b == 'L') return 'R';
+  if (a == 'S' && b == 'R') return 'L';
+  if (a == 'L' && b == 'S') return 'R';
+  if (a == 'R' && b == 'S') return 'L';
+  if (a == 'L' && b == 'L') return 'S';
+  if (a == 'R' && b == 'R') return 'S';
+  if (a == 'R' && b == 'L') return 'U';
+  if (a == 'L' && b == 'R') return 'U';
+  if (a == 'S' && b == 'S') return 'U';
+  return 0;
+}
+
+void optimizePath(char path[], char out[], int& count) {
+  bool simplified = true;
+
+  while (simplified) {
+    simplified = false;
+    int optIndex = 0;
+
+    for (int i = 0; i <= count; ++i) {
+      // Check for patterns of 3 decisions to apply simplification rules
+      char shortcut = 0;
+      if (i < count - 1 && path[i + 1] == 'U') {
+        shortcut = reduce(path[i], path[i + 2]);
+      }
+      if (shortcut) {
+        out[optIndex++] = shortcut;
+        i += 2; // Skip two additional positions
+        simplified = true;
+      }
+      else {
+        out[optIndex++] = path[i];
+      }
+    }
+
+    // Copy the optimized path back to the original array
+    bool uTurns = false;
+    for (int i = 0; i < optIndex; i++) {
+      path[i] = out[i];
+      if (out[i] == 'U') {
+        uTurns = true;
+      }
+    }
+
+    // Later passes only scan what is left of the path
+    count = optIndex - 1;
+    if (!uTurns) {
+      break;
+    }
+  }
+}
+
+char routeTurn(const char path[], int count, int step, bool back) {
+  if (back) {
+    return invertTurn(path[count - step]);
+  }
+  return path[step];
+}
+
+static_assert(invertTurn(invertTurn('L')) == 'L' && invertTurn('S') == 'S', "invertTurn");
+
+} // namespace maze
@@ -0,0 +1,72 @@
+//===============================
+// MazeDecision
+// Hardware-free maze decision engine: search rules, the record/forced
+// classification of a turn, decision history storage and path
+// optimization. Everything is passed in and out explicitly; there is no
+// global state and no Arduino header, so it builds on the host as is.
+//
+// Decisions are 'L', 'R', 'S' (straight) and 'U' (U-turn), plus 'F'
+// for the finish, where the explorer stops.
+//===============================
+
+#ifndef MAZE_DECISION_H
+#define MAZE_DECISION_H
+
+#include <stdint.h>
+
+//Branches seen at an intersection (leftMem/centerMem/rightMem)
+struct Junction {
+  bool left;
+  bool center;
+  bool right;
+};
+
+enum DecisionKind : uint8_t {
+  DECISION_IGNORED,  //taken but neither recorded nor forced
+  DECISION_RECORDED, //a real choice, goes in the history
+  DECISION_FORCED,   //the only way on, never recorded
+};
+
+//What the explorer does at an intersection, and whether it is recorded
+struct JunctionAction {
+  char decision;
+  DecisionKind kind;
+};
+
+namespace maze {
+
+//Everything the explorer's choice depends on, packed into a table index:
+//bit 0 left, 1 center, 2 right, 3 finish pad (all sensors still on the
+//line after the probe), 4 right hand rule.
+const uint8_t JUNCTION_CODES = 32;
+
+constexpr uint8_t junctionCode(Junction j, bool finish, bool rightHand) {
+  return (uint8_t)(j.left | j.center << 1 | j.right << 2 | finish << 3 | rightHand << 4);
+}
+
+//Wall-follower choice and record/forced classification for a code, in
+//one table read. The table is checked against the search rules at
+//compile time, see MazeDecision.cpp.
+JunctionAction junctionAction(uint8_t code);
+
+//Appends decision to path. count is the index of the last entry, -1
+//when empty. Returns false, without storing, if the path is full.
+bool storeDecision(char path[], int& count, int capacity, char decision);
+
+//Removes U-turn detours from path until none are left. The reduced path
+//is written to out and back to path, and count is updated.
+void optimizePath(char path[], char out[], int& count);
+
+//Turn that retraces decision the other way: L and R swap, S and U stay.
+constexpr char invertTurn(char decision) {
+  return decision == 'L' ? 'R' : decision == 'R' ? 'L' : decision;
+}
+
+//Turn at the step-th recorded intersection (from 0) of a reduced path.
+//With back set the path is driven from the finish to the start: last
+//turn first, each inverted. count is the index of the last entry.
+char routeTurn(const char path[], int count, int step, bool back);
+
+} // namespace maze
+
+#endif
@@ -0,0 +1,278 @@
+//===============================
+// MazeGraph
+// Explored maze layout and shortest known routes.
+//===============================
+
+#include "MazeGraph.h"
+
+MazeGraph::MazeGraph(IntersectionMap& map) : map(map) {
+  clear();
+}
+
+void MazeGraph::clear() {
+  linkCount = 0;
+}
+
+void MazeGraph::addExits(uint8_t node, uint8_t mask) {
+  map.addExits(node, mask);
+}
+
+void MazeGraph::link(uint8_t a, uint8_t da, uint8_t b, uint8_t db, uint16_t mm) {
+  if (a >= map.count() || b >= map.count()) {
+    return;
+  }
+  uint16_t cm = (mm + 5) / 10;
+  if (cm > 255) {cm = 255;}
+  if (cm == 0) {cm = 1;}
+  da &= 3;
+  db &= 3;
+  //a line remeasured, or found to lead elsewhere, replaces what was known
+  uint8_t i;
+  while ((i = findLink(a, da)) != NONE || (i = findLink(b, db)) != NONE) {
+    links[i] = links[--linkCount];
+  }
+  if (linkCount >= MAX_LINKS) {
+    return;
+  }
+  MazeLink& l = links[linkCount++];
+  l.a = a;
+  l.b = b;
+  l.dirs = da | db << 2;
+  l.cm = cm;
+  map.addExits(a, 1 << da);
+  map.addExits(b, 1 << db);
+}
+
+uint8_t MazeGraph::findLink(uint8_t node, uint8_t d) const {
+  for (uint8_t i = 0; i < linkCount; i++) {
+    const MazeLink& l = links[i];
+    if ((l.a == node && (l.dirs & 3) == d) || (l.b == node && (l.dirs >> 2) == d)) {
+      return i;
+    }
+  }
+  return NONE;
+}
+
+uint8_t MazeGraph::neighbour(uint8_t node, uint8_t d) const {
+  uint8_t i = findLink(node, d & 3);
+  if (i == NONE) {
+    return NONE;
+  }
+  const MazeLink& l = links[i];
+  return l.a == node && (l.dirs & 3) == (d & 3) ? l.b : l.a;
+}
+
+void MazeGraph::shortest(uint8_t from, uint16_t dist[], uint8_t back[]) const {
+  bool done[MAX_NODES];
+  for (uint8_t n = 0; n < MAX_NODES; n++) {
+    dist[n] = FAR;
+    back[n] = NONE;
+    done[n] = false;
+  }
+  if (from >= map.count()) {
+    return;
+  }
+  dist[from] = 0;
+
+  while (true) {
+    //closest node not settled yet; the graph is small, a scan is enough
+    uint8_t u = NONE;
+    for (uint8_t n = 0; n < map.count(); n++) {
+      if (!done[n] && dist[n] != FAR && (u == NONE || dist[n] < dist[u])) {
+        u = n;
+      }
+    }
+    if (u == NONE) {
+      return;
+    }
+    done[u] = true;
+    for (uint8_t i = 0; i < linkCount; i++) {
+      const MazeLink& l = links[i];
+      //v is entered through exit e, the way back to u
+      uint8_t v, e;
+      if (l.a == u) {v = l.b; e = l.dirs >> 2;}
+      else if (l.b == u) {v = l.a; e = l.dirs & 3;}
+      else {continue;}
+      if (done[v]) {
+        continue;
+      }
+      uint32_t alt = (uint32_t)dist[u] + l.cm * 10;
+      if (alt < dist[v]) {
+        dist[v] = alt;
+        back[v] = e;
+      }
+    }
+  }
+}
+
+uint8_t MazeGraph::arrivalExit(uint8_t node, uint8_t d) const {
+  uint8_t i = findLink(node, d & 3);
+  if (i == NONE) {
+    return NONE;
+  }
+  const MazeLink& l = links[i];
+  return l.a == node && (l.dirs & 3) == (d & 3) ? l.dirs >> 2 : l.dirs & 3;
+}
+
+uint16_t MazeGraph::linkLength(uint8_t node, uint8_t d) const {
+  uint8_t i = findLink(node, d & 3);
+  return i == NONE ? 0 : links[i].cm * 10;
+}
+
+uint8_t MazeGraph::arrivalDir(uint8_t node, uint8_t d) const {
+  uint8_t e = arrivalExit(node, d);
+  return e == NONE ? NONE : (e + 2) & 3;
+}
+
+uint8_t MazeGraph::follow(uint8_t node, uint8_t& d, char turn) const {
+  uint8_t in = arrivalDir(node, d);
+  if (in == NONE) {
+    return NONE;
+  }
+  node = neighbour(node, d);
+  d = maze::turnDir(in, turn);
+  return node;
+}
+
+uint8_t MazeGraph::routeArrival(uint8_t from, uint8_t d, const char path[], int count, uint8_t to) const {
+  uint8_t n = from;
+  for (int k = 0; k <= count && n != NONE; k++) {
+    n = follow(n, d, path[k]);
+  }
+  if (n == NONE) {
+    return NONE;
+  }
+  uint8_t in = arrivalDir(n, d);
+  return in != NONE && neighbour(n, d) == to ? in : NONE;
+}
+
+uint8_t MazeGraph::locate(uint8_t node, uint8_t d, uint16_t mm, uint8_t seen, uint8_t& in) const {
+  uint8_t best = NONE;
+  uint16_t bestScore = FAR;
+  uint16_t cum = 0;
+  in = NONE;
+  d &= 3;
+  for (uint8_t depth = 0; depth < LOCATE_DEPTH; depth++) {
+    uint8_t dir = arrivalDir(node, d);
+    if (dir == NONE) {
+      break;
+    }
+    cum += linkLength(node, d);
+    node = neighbour(node, d);
+
+    //branches the map has here, in the order of seen
+    uint8_t open = exits(node);
+    uint8_t mapped = 0;
+    if (open & (1 << maze::turnDir(dir, 'L'))) {mapped |= 1 << 0;}
+    if (open & (1 << dir)) {mapped |= 1 << 1;}
+    if (open & (1 << maze::turnDir(dir, 'R'))) {mapped |= 1 << 2;}
+    uint8_t differ = (mapped ^ seen) & 0x07;
+    uint16_t limit = LOCATE_SLACK_MM + cum / 8;
+    uint16_t score = mm > cum ? mm - cum : cum - mm;
+    if (depth == 0 && differ == 0 && mm >= cum / 2 && score > limit && mm < cum) {
+      //a line lost and found again while exploring measures long
+      score = limit;
+    }
+    for (; differ; differ >>= 1) {
+      if (differ & 1) {
+        score += LOCATE_EXIT_MM;
+      }
+    }
+    if (score < bestScore && score <= limit) {
+      bestScore = score;
+      best = node;
+      in = dir;
+    }
+
+    //only a straight-on line could have been driven through unseen
+    if (!(open & (1 << dir)) || cum > mm) {
+      break;
+    }
+    d = dir;
+  }
+  return best;
+}
+
+uint16_t MazeGraph::routeLength(uint8_t from, uint8_t to) const {
+  uint16_t dist[MAX_NODES];
+  uint8_t back[MAX_NODES];
+  if (to >= map.count()) {
+    return FAR;
+  }
+  shortest(from, dist, back);
+  return dist[to];
+}
+
+uint8_t MazeGraph::firstExit(uint8_t from, uint8_t to) const {
+  uint16_t dist[MAX_NODES];
+  uint8_t back[MAX_NODES];
+  if (from == to || to >= map.count()) {
+    return NONE;
+  }
+  //search from the target, so following back[] walks towards it
+  shortest(to, dist, back);
+  return from < map.count() ? back[from] : NONE;
+}
+
+RoutePlan MazeGraph::plan(uint8_t start, uint8_t finish, uint8_t& node, uint8_t& dir) const {
+  uint16_t dist[MAX_NODES];
+  uint8_t back[MAX_NODES];
+  shortest(start, dist, back);
+  uint16_t best = finish < map.count() ? dist[finish] : FAR;
+
+  uint32_t lowest = FAR;
+  node = NONE;
+  dir = NONE;
+  for (uint8_t n = 0; n < map.count(); n++) {
+    if (dist[n] == FAR || n == finish) {
+      continue;
+    }
+    uint8_t open = exits(n);
+    for (uint8_t d = 0; d < 4; d++) {
+      if (!(open & (1 << d)) || findLink(n, d) != NONE) {
+        continue;
+      }
+      //any route through this exit still has to get from n to the finish
+      uint32_t bound = dist[n];
+      if (finish < map.count()) {
+        bound += map.distance(n, finish);
+      }
+      if (bound < lowest) {
+        lowest = bound;
+        node = n;
+        dir = d;
+      }
+    }
+  }
+
+  if (node != NONE && lowest < best) {
+    return PLAN_EXPLORE;
+  }
+  return best == FAR ? PLAN_NO_ROUTE : PLAN_OPTIMAL;
+}
+
+int MazeGraph::route(uint8_t start, uint8_t finish, char path[], int capacity) const {
+  uint16_t dist[MAX_NODES];
+  uint8_t back[MAX_NODES];
+  if (start >= map.count() || finish >= map.count()) {
+    return -1;
+  }
+  //from the finish, so back[] at each node points along the route
+  shortest(finish, dist, back);
+  if (dist[start] == FAR) {
+    return -1;
+  }
+
+  int count = -1;
+  uint8_t n = neighbour(start, back[start]);
+  uint8_t in = arrivalExit(start, back[start]);
+  while (n != finish && count + 1 < capacity) {
+    //travelling into n opposite to the exit it is entered by
+    uint8_t out = back[n];
+    count++;
+    path[count] = maze::turnBetween((in + 2) & 3, out);
+    in = arrivalExit(n, out);
+    n = neighbour(n, out);
+  }
+  return count;
+}
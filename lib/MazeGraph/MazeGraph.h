@@ -0,0 +1,156 @@
+//===============================
+// MazeGraph
+// What is known of the maze's layout: the exits seen at each
+// intersection, which of them have been followed, where each one led
+// and how long that line was. The nodes are those of the
+// IntersectionMap the robot visits, which also holds each node's exits;
+// the graph itself only keeps a list of the lines followed between
+// them. Exits are absolute directions, 0 = +x, 1 = +y, 2 = -x, 3 = -y
+// (90 degree steps, counter-clockwise).
+//
+// Answers the shortest known route between two nodes, and whether an
+// exit never followed could still lead to a shorter start-to-finish
+// route. The unknown part of such a route is bounded below by the
+// Manhattan distance to the finish (maze lines are axis aligned), so
+// once no unexplored exit beats the best known route, that route is
+// the shortest there is.
+//
+// On a timed run the map also answers where the robot is: given the
+// node it last left, the exit it took, how far it has come and the
+// branches it sees, locate() picks the node it most likely stands at,
+// allowing for intersections it drove through without seeing.
+// Integer only, no Arduino headers.
+//===============================
+
+#ifndef MAZE_GRAPH_H
+#define MAZE_GRAPH_H
+
+#include <stdint.h>
+#include <Odometry.h>
+
+enum RoutePlan : uint8_t {
+  PLAN_EXPLORE,  //an unexplored exit could still shorten the route
+  PLAN_OPTIMAL,  //the best known route is the shortest possible
+  PLAN_NO_ROUTE, //start and finish are not connected yet
+};
+
+//Line followed between exit da of node a and exit db of node b.
+struct MazeLink {
+  uint8_t a;
+  uint8_t b;
+  uint8_t dirs; //da in bits 0-1, db in bits 2-3
+  uint8_t cm;   //length, 1..255
+};
+
+class MazeGraph {
+public:
+  static const uint8_t MAX_NODES = IntersectionMap::MAX_NODES;
+  //A tree of MAX_NODES nodes has one line fewer; the rest is for loops.
+  static const uint8_t MAX_LINKS = MAX_NODES + 8;
+  static const uint8_t NONE = 0xFF;
+  static const uint16_t FAR = 0xFFFF;
+  static const uint8_t LOCATE_DEPTH = 4;
+  static const uint16_t LOCATE_EXIT_MM = 50;
+  static const uint16_t LOCATE_SLACK_MM = 80;
+
+  explicit MazeGraph(IntersectionMap& map);
+
+  //Forgets every line followed. The exits seen go with the map's nodes.
+  void clear();
+
+  //Exits seen at node, one bit per direction, added to earlier sightings.
+  void addExits(uint8_t node, uint8_t mask);
+
+  //Leaving a through exit da arrived at b through exit db after mm of
+  //line (corners included). Both exits count as explored. Replaces any
+  //line known from either exit; ignored once MAX_LINKS are known.
+  void link(uint8_t a, uint8_t da, uint8_t b, uint8_t db, uint16_t mm);
+
+  uint8_t exits(uint8_t node) const {return node < map.count() ? map.node(node).exits : 0;}
+
+  //Node reached through exit d of node, NONE if not followed yet.
+  uint8_t neighbour(uint8_t node, uint8_t d) const;
+
+  //Length in mm of the line behind exit d of node, 0 if not followed.
+  uint16_t linkLength(uint8_t node, uint8_t d) const;
+
+  //Direction of travel on reaching the node behind exit d of node,
+  //NONE if not followed.
+  uint8_t arrivalDir(uint8_t node, uint8_t d) const;
+
+  //Node reached through exit d of node, where turn is taken: d is set
+  //to the exit that leaves it by. NONE, d unchanged, if the link has
+  //not been followed. Walking a route this way gives the node of each
+  //of its turns, so the route itself need not store them.
+  uint8_t follow(uint8_t node, uint8_t& d, char turn) const;
+
+  //Direction of travel on reaching to after leaving from through exit d
+  //and taking path[0..count], each turn at the node reached, NONE
+  //unless that is a drive over followed links.
+  uint8_t routeArrival(uint8_t from, uint8_t d, const char path[], int count, uint8_t to) const;
+
+  //Node most likely reached after leaving node through exit d and
+  //driving mm, straight through up to LOCATE_DEPTH intersections that
+  //may have gone unseen. seen holds the branches found, relative to
+  //the direction of travel: bit 0 left, 1 straight on, 2 right. Each
+  //candidate scores its distance error plus LOCATE_EXIT_MM per branch
+  //the map disagrees on; the best is taken if it is within
+  //LOCATE_SLACK_MM plus an eighth of its distance, else NONE. The next
+  //node with every branch as seen is also taken from half its distance
+  //on, as a link can be mapped long. in gets the direction of travel
+  //there.
+  uint8_t locate(uint8_t node, uint8_t d, uint16_t mm, uint8_t seen, uint8_t& in) const;
+
+  //Length of the shortest known route, FAR if none.
+  uint16_t routeLength(uint8_t from, uint8_t to) const;
+
+  //Exit to take at from on the shortest known route to to, NONE if
+  //there is no route or from == to.
+  uint8_t firstExit(uint8_t from, uint8_t to) const;
+
+  //Picks the unexplored exit with the lowest bound on a start-to-finish
+  //route through it (node, dir), unless the best known route already
+  //meets every such bound.
+  RoutePlan plan(uint8_t start, uint8_t finish, uint8_t& node, uint8_t& dir) const;
+
+  //Turns ('L', 'R', 'S', 'U') at each node strictly between start and
+  //finish on the shortest known route, in the format of the optimized
+  //path. Returns the index of the last turn, -1 for none or no route.
+  int route(uint8_t start, uint8_t finish, char path[], int capacity) const;
+
+private:
+  //Dijkstra from from over followed exits. dist in mm, back[n] is the
+  //exit of n leading towards from (NONE at from and unreached nodes).
+  void shortest(uint8_t from, uint16_t dist[], uint8_t back[]) const;
+
+  //Exit of the node behind exit d of node that leads back over the same line.
+  uint8_t arrivalExit(uint8_t node, uint8_t d) const;
+
+  //Index of the line leaving node through exit d, NONE if not followed.
+  uint8_t findLink(uint8_t node, uint8_t d) const;
+
+  IntersectionMap& map;
+  MazeLink links[MAX_LINKS];
+  uint8_t linkCount;
+};
+
+namespace maze {
+
+//Exit direction for a heading (brad, 0 = +x).
+constexpr uint8_t headingDir(uint16_t brad) {
+  return (uint8_t)(((uint16_t)(brad + 0x2000)) >> 14);
+}
+
+//Turn that takes a robot heading along direction from onto direction to.
+constexpr char turnBetween(uint8_t from, uint8_t to) {
+  return "SLUR"[(to - from) & 3];
+}
+
+//Direction after taking turn while heading along from.
+constexpr uint8_t turnDir(uint8_t from, char turn) {
+  return (uint8_t)((from + (turn == 'L' ? 1 : turn == 'U' ? 2 : turn == 'R' ? 3 : 0)) & 3);
+}
+
+} // namespace maze
+
+#endif
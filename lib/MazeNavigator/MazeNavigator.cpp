@@ -0,0 +1,245 @@
+//===============================
+// MazeNavigator
+// Maze map position and route following, see MazeNavigator.h.
+//===============================
+
+#include "MazeNavigator.h"
+#include <FixedPoint.h>
+
+MazeNavigator::MazeNavigator(IntersectionMap& map, MazeGraph& graph, char path[], int& count)
+  : map(map), graph(graph), path(path), count(count) {
+  start = finish = IntersectionMap::NO_NODE;
+  mapNode = IntersectionMap::NO_NODE;
+  mapDir = 0;
+  atNode = false;
+  leaveDist = 0;
+  heading0 = 0;
+  shiftX = shiftY = 0;
+  backRun = onMap = lost = false;
+  step = -1;
+  relocated = 0;
+}
+
+//==================== Map ========================================
+
+void MazeNavigator::mapStart(const NavPose& pose) {
+  map.clear(); //the graph's nodes and their exits
+  graph.clear();
+  finish = IntersectionMap::NO_NODE;
+  heading0 = pose.heading;
+  shiftX = 0;
+  shiftY = 0;
+  start = map.visit(0, 0);
+  graph.addExits(start, 1 << 0);
+  mapNode = start;
+  mapDir = 0;
+  atNode = false;
+  leaveDist = pose.distance;
+}
+
+uint8_t MazeNavigator::mapArrive(JunctionAction action, Junction seen, const NavPose& pose, uint8_t expected) {
+  //heading of the pose the positions are integrated with, squared up
+  //to the maze grid at every node
+  uint8_t in = maze::headingDir(pose.heading - heading0);
+  heading0 = pose.heading - ((uint16_t)in << 14);
+  int16_t x = pose.x + shiftX;
+  int16_t y = pose.y + shiftY;
+
+  uint8_t node;
+  if (action.decision == 'F' && finish != IntersectionMap::NO_NODE) {
+    node = finish; //the pad is entered from different sides
+  }
+  else if (expected != IntersectionMap::NO_NODE) {
+    node = expected;
+  }
+  else {
+    node = map.find(x, y);
+  }
+  if (node == IntersectionMap::NO_NODE) {
+    node = map.visit(x, y);
+  }
+  else {
+    //a known node: count the visit and take its position as the truth
+    const MapNode& known = map.node(node);
+    map.visit(known.x, known.y);
+    shiftX += known.x - x;
+    shiftY += known.y - y;
+  }
+  if (action.decision == 'F') {
+    finish = node;
+  }
+
+  uint8_t behind = (in + 2) & 3;
+  uint8_t exits = 1 << behind;
+  if (action.decision != 'F') {
+    if (seen.left) {exits |= 1 << maze::turnDir(in, 'L');}
+    if (seen.center) {exits |= 1 << in;}
+    if (seen.right) {exits |= 1 << maze::turnDir(in, 'R');}
+  }
+  graph.addExits(node, exits);
+  graph.link(mapNode, mapDir, node, behind, fx::ticksToMm(pose.distance - leaveDist));
+  mapNode = node;
+  mapDir = in;
+  atNode = true;
+  return node;
+}
+
+void MazeNavigator::mapLeave(char turn, const NavPose& pose) {
+  if (!atNode) {
+    return;
+  }
+  mapDir = maze::turnDir(mapDir, turn);
+  leaveDist = pose.distance;
+  atNode = false;
+}
+
+char MazeNavigator::turnTowards(uint8_t target, uint8_t& expected) const {
+  uint8_t exit = graph.firstExit(mapNode, target);
+  if (exit == MazeGraph::NONE) {
+    return 0;
+  }
+  expected = graph.neighbour(mapNode, exit);
+  return maze::turnBetween(mapDir, exit);
+}
+
+RoutePlan MazeNavigator::plan(uint8_t& node, uint8_t& dir) const {
+  return graph.plan(start, finish, node, dir);
+}
+
+void MazeNavigator::takeBestRoute(char history[], int capacity) {
+  if (graph.routeLength(start, finish) == MazeGraph::FAR) {
+    return;
+  }
+  count = graph.route(start, finish, path, capacity);
+  for (int i = 0; i <= count; i++) {
+    history[i] = path[i];
+  }
+}
+
+//==================== Route ======================================
+
+void MazeNavigator::routeStart(bool back, const NavPose& pose) {
+  backRun = back;
+  lost = false;
+  step = -1;
+  relocated = 0;
+  onMap = false;
+  if (start == IntersectionMap::NO_NODE || finish == IntersectionMap::NO_NODE) {
+    return;
+  }
+  uint8_t in = graph.routeArrival(start, 0, path, count, finish);
+  if (in == MazeGraph::NONE) {
+    return;
+  }
+  onMap = true;
+  //from the finish, standing on it as arrived; the U-turn leaves it
+  mapNode = back ? finish : start;
+  mapDir = back ? in : 0;
+  atNode = back;
+  leaveDist = pose.distance;
+}
+
+char MazeNavigator::routeStep(JunctionAction action, Junction seen, const NavPose& pose) {
+  uint8_t node = MazeGraph::NONE;
+  uint8_t in = MazeGraph::NONE;
+  uint16_t mm = fx::ticksToMm(pose.distance - leaveDist);
+  if (onMap && !lost) {
+    uint8_t branches = (seen.left ? 1 : 0) | (seen.center ? 2 : 0) | (seen.right ? 4 : 0);
+    node = graph.locate(mapNode, mapDir, mm, branches, in);
+  }
+  uint8_t goal = backRun ? start : finish;
+  if ((node != MazeGraph::NONE && node == goal) || (!backRun && action.decision == 'F') ||
+      (!onMap && !lost && step == count)) {
+    return 'F';
+  }
+
+  char turn = 0;
+  if (!lost) {
+    turn = routeDecision(action, seen, mm, node, in);
+    lost = turn == 0;
+    if (lost && backRun) {
+      atNode = false;
+      return 0;
+    }
+  }
+  if (lost) {
+    turn = action.decision; //the search rule, as exploring
+  }
+  if (turn == 'U' && seen.right) {
+    turn = 'R';
+  }
+  atNode = node != MazeGraph::NONE && !lost;
+  return turn;
+}
+
+char MazeNavigator::routeDecision(JunctionAction action, Junction seen, uint16_t mm, uint8_t node, uint8_t in) {
+  if (action.kind == DECISION_IGNORED && (!onMap || node == MazeGraph::NONE)) {
+    return 'S'; //not an intersection the route counts
+  }
+  if (!onMap) {
+    if (action.kind == DECISION_FORCED) {
+      return action.decision;
+    }
+    char turn = maze::routeTurn(path, count, step + 1, backRun);
+    bool branch = turn == 'L' ? seen.left : turn == 'S' ? seen.center : turn == 'R' ? seen.right : true;
+    if (!branch) {
+      return 0;
+    }
+    step++;
+    return turn;
+  }
+
+  if (node == MazeGraph::NONE) {
+    if (action.kind == DECISION_FORCED) {
+      return action.decision; //a corner of the link
+    }
+    if (seen.center && mm + MazeGraph::LOCATE_SLACK_MM < graph.linkLength(mapNode, mapDir)) {
+      relocated++;
+      return 'S'; //nothing on the map here, a glitch
+    }
+    return 0;
+  }
+
+  //on the route ahead, its exit there; off it, the shortest way back
+  int at = routeStepAt(node);
+  uint8_t exit = at >= 0 ? routeExit(at) : graph.firstExit(node, backRun ? start : finish);
+  if (exit == MazeGraph::NONE) {
+    return 0;
+  }
+  if (at != step + 1) {
+    relocated++;
+  }
+  if (at >= 0) {
+    step = at;
+  }
+  mapNode = node;
+  mapDir = in;
+  return maze::turnBetween(in, exit);
+}
+
+int MazeNavigator::routeStepAt(uint8_t node) const {
+  int found = -1;
+  uint8_t at = start;
+  uint8_t dir = 0;
+  for (int i = 0; i <= count; i++) {
+    at = graph.follow(at, dir, path[i]);
+    int s = backRun ? count - i : i;
+    if (at == node && s > step && (found < 0 || s < found)) {
+      found = s;
+    }
+  }
+  return found;
+}
+
+uint8_t MazeNavigator::routeExit(int at) const {
+  int last = backRun ? count - at : at;
+  uint8_t node = start;
+  uint8_t dir = 0;
+  uint8_t in = 0;
+  for (int i = 0; i <= last; i++) {
+    in = graph.arrivalDir(node, dir);
+    node = graph.follow(node, dir, path[i]);
+  }
+  //driven backwards, the route leaves where it came in going forwards
+  return backRun ? (in + 2) & 3 : dir;
+}
@@ -0,0 +1,119 @@
+//===============================
+// MazeNavigator
+// Where the robot is on the maze graph and which way it goes there.
+// Maps every intersection the explorer stops at, drives the optimized
+// route with each intersection located on the map so a missed or
+// misread one costs at most a detour, and gives the moves of the
+// post-finish search. The caller drives, probes and turns: it hands in
+// what the probe saw and the odometry pose, and gets the turn to take.
+// The sketch and the simulator both run it. Integer only, no Arduino
+// headers.
+//===============================
+
+#ifndef MAZE_NAVIGATOR_H
+#define MAZE_NAVIGATOR_H
+
+#include <stdint.h>
+#include <Odometry.h>
+#include <MazeDecision.h>
+#include <MazeGraph.h>
+
+//Odometry pose at an intersection
+struct NavPose {
+  int32_t distance; //ticks, see Odometry::distance()
+  int16_t x;        //mm
+  int16_t y;
+  uint16_t heading; //brad
+};
+
+class MazeNavigator {
+public:
+  //The graph must be built on map. path[0..count] is the optimized
+  //route; it stays with the caller, which stores, shows and prints it.
+  MazeNavigator(IntersectionMap& map, MazeGraph& graph, char path[], int& count);
+
+  //==== Map ====
+
+  //Clears the map and starts it at the start, a dead end left facing
+  //direction 0.
+  void mapStart(const NavPose& pose);
+
+  //Visits the intersection just probed and adds the branches seen there
+  //to the graph, linked to the node last left. expected is the node a
+  //known link leads to, NO_NODE when exploring. Returns the node.
+  uint8_t mapArrive(JunctionAction action, Junction seen, const NavPose& pose, uint8_t expected);
+
+  //Leaving the node last arrived at with turn. Does nothing between
+  //nodes: after a lone branch, or an intersection the route did not
+  //place on the map.
+  void mapLeave(char turn, const NavPose& pose);
+
+  //Turn at the current node onto the shortest known route to target,
+  //0 if there is none or it is reached. expected gets the next node.
+  char turnTowards(uint8_t target, uint8_t& expected) const;
+
+  //Next unexplored exit worth following after the finish, see
+  //MazeGraph::plan(), and the turn at its node that takes it.
+  RoutePlan plan(uint8_t& node, uint8_t& dir) const;
+  char turnOnto(uint8_t dir) const {return maze::turnBetween(mapDir, dir);}
+
+  //Makes the shortest known route the optimized path and the history,
+  //if start and finish are connected.
+  void takeBestRoute(char history[], int capacity);
+
+  uint8_t startNode() const {return start;}
+  uint8_t finishNode() const {return finish;}
+  uint8_t node() const {return mapNode;}
+
+  //==== Route ====
+
+  //Starts a drive of the optimized path, from the start or with back
+  //set from the finish, which is left by a U-turn. Without the route on
+  //the graph only the branch of each turn is checked.
+  void routeStart(bool back, const NavPose& pose);
+
+  //Turn to take at the intersection just probed. 'F' when the goal is
+  //reached; 0 when the route is lost on the way back, which cannot
+  //end by rule. Lost on the way to the finish, the search rule's
+  //action is returned from then on.
+  char routeStep(JunctionAction action, Junction seen, const NavPose& pose);
+
+  //Since routeStart(): intersections where the route was picked up off
+  //its next node, and whether it fell back to the search rule.
+  uint16_t relocations() const {return relocated;}
+  bool routeLost() const {return lost;}
+
+private:
+  //Turn for the route step, 0 if the route is lost. node is where the
+  //map puts the robot, arriving along in, NONE if nowhere or the route
+  //is not on the map.
+  char routeDecision(JunctionAction action, Junction seen, uint16_t mm, uint8_t node, uint8_t in);
+
+  //Step of the route still ahead that is taken at node, -1 if none
+  int routeStepAt(uint8_t node) const;
+
+  //Direction the route leaves the node of its step-th turn by
+  uint8_t routeExit(int at) const;
+
+  IntersectionMap& map;
+  MazeGraph& graph;
+  char* path;
+  int& count;
+
+  uint8_t start, finish;
+  uint8_t mapNode;    //last node reached
+  uint8_t mapDir;     //direction of travel since mapNode
+  bool atNode;        //standing at mapNode, not left yet
+  int32_t leaveDist;  //ticks, when mapNode was left
+  uint16_t heading0;  //odometry heading of direction 0
+  int16_t shiftX;     //mm, odometry correction, re-anchored at known nodes
+  int16_t shiftY;
+
+  bool backRun;       //route driven from the finish
+  bool onMap;         //route on the graph
+  bool lost;
+  int step;           //last route step taken, -1 before the first
+  uint16_t relocated;
+};
+
+#endif
@@ -0,0 +1,101 @@
+//===============================
+// MemoryStats
+// Stack painting and SRAM usage figures.
+//===============================
+
+#include "MemoryStats.h"
+
+#ifdef __AVR__
+
+#include <avr/io.h>
+
+//Linker and malloc symbols
+extern uint8_t __data_start;
+extern uint8_t __data_end;
+extern uint8_t __bss_start;
+extern uint8_t __bss_end;
+extern uint8_t __heap_start;
+extern uint8_t _end;
+extern uint8_t __stack;
+extern char* __brkval;
+
+static const uint8_t CANARY = 0xC5;
+static uint16_t heapPeak = 0;
+
+//Runs from .init3, after the stack pointer is set up and before .data
+//and .bss are initialized, so nothing above the static data is live yet.
+void paintStack(void) __attribute__((naked, used, section(".init3")));
+void paintStack(void) {
+  uint8_t* p = &_end;
+  while (p <= &__stack) {
+    *p = CANARY;
+    p++;
+  }
+}
+
+static uint8_t* heapTop() {
+  return __brkval ? (uint8_t*)__brkval : &__heap_start;
+}
+
+namespace mem {
+
+uint16_t freeNow() {
+  uint8_t top;
+  return &top - heapTop();
+}
+
+uint16_t freeMin() {
+  //start above the highest heap top seen; a heap that shrank back
+  //leaves its old contents, not canary, behind
+  const uint8_t* p = heapTop();
+  if (p < &__heap_start + heapPeak) {
+    p = &__heap_start + heapPeak;
+  }
+  uint16_t count = 0;
+  while (p <= &__stack && *p == CANARY) {
+    p++;
+    count++;
+  }
+  return count;
+}
+
+void sample() {
+  uint16_t heap = heapTop() - &__heap_start;
+  if (heap > heapPeak) {
+    heapPeak = heap;
+  }
+}
+
+MemoryReport report() {
+  sample();
+  MemoryReport r;
+  r.total = RAMEND - RAMSTART + 1;
+  r.data = &__data_end - &__data_start;
+  r.bss = &__bss_end - &__bss_start;
+  r.heap = heapTop() - &__heap_start;
+  r.heapPeak = heapPeak;
+  r.free = freeNow();
+  r.freeMin = freeMin();
+  //untouched canary sits just above the heap peak, the rest was stack
+  r.stackPeak = (&__stack - (&__heap_start + heapPeak) + 1) - r.freeMin;
+  return r;
+}
+
+} // namespace mem
+
+#else
+
+namespace mem {
+
+uint16_t freeNow() {return 0;}
+uint16_t freeMin() {return 0;}
+void sample() {}
+
+MemoryReport report() {
+  MemoryReport r = {0, 0, 0, 0, 0, 0, 0, 0};
+  return r;
+}
+
+} // namespace mem
+
+#endif
@@ -0,0 +1,46 @@
+//===============================
+// MemoryStats
+// SRAM budget of the running sketch: static data, heap and stack.
+// Free SRAM between the heap and the stack is painted with a canary at
+// startup, before any constructor runs, so the deepest stack excursion
+// since reset can be read back later as the canary bytes left untouched.
+//
+// AVR only; on other targets every figure is 0. No Arduino headers.
+//===============================
+
+#ifndef MEMORY_STATS_H
+#define MEMORY_STATS_H
+
+#include <stdint.h>
+
+struct MemoryReport {
+  uint16_t total;      //SRAM size
+  uint16_t data;       //initialized globals (.data)
+  uint16_t bss;        //zeroed globals (.bss)
+  uint16_t heap;       //heap in use (malloc break above heap start)
+  uint16_t heapPeak;   //largest heap seen by memorySample()
+  uint16_t free;       //gap between heap and stack now
+  uint16_t stackPeak;  //deepest stack since reset
+  uint16_t freeMin;    //smallest gap between heap and stack since reset
+};
+
+namespace mem {
+
+//Current gap between the heap top and the stack pointer, in bytes.
+uint16_t freeNow();
+
+//Bytes above the highest heap top seen and below the deepest stack
+//since reset, i.e. still holding the canary. Scans free SRAM, so keep
+//it out of tight loops.
+uint16_t freeMin();
+
+//Records the heap size for the peak figure. Cheap; call it where
+//Strings or other heap users come and go.
+void sample();
+
+//All figures at once.
+MemoryReport report();
+
+} // namespace mem
+
+#endif
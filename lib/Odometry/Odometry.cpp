@@ -0,0 +1,131 @@
+//===============================
+// Odometry
+// Encoder dead reckoning and a coordinate map of maze intersections.
+//===============================
+
+#include "Odometry.h"
+#include <FixedPoint.h>
+
+//==================== Odometry ===================================
+
+Odometry::Odometry() {
+  reset();
+}
+
+void Odometry::reset() {
+  x = 0;
+  y = 0;
+  diffTicks = 0;
+  travelled = 0;
+  theta = 0;
+}
+
+void Odometry::update(int16_t dL, int16_t dR) {
+  //Heading comes from the total wheel difference, so rounding does
+  //not accumulate between updates.
+  diffTicks += dR - dL;
+  uint16_t newTheta = fx::diffTicksToBrad(diffTicks);
+
+  //advance along the mean heading of this step
+  uint16_t midTheta = theta + (int16_t)(newTheta - theta) / 2;
+  int16_t center = (dL + dR) / 2;
+  int32_t step = fx::mulQ(center, fx::MM_PER_TICK_Q16, 12); //1/16 mm
+
+  x += (step * fx::cosQ14(midTheta)) >> 14;
+  y += (step * fx::sinQ14(midTheta)) >> 14;
+  theta = newTheta;
+
+  if (center < 0) {
+    center = -center;
+  }
+  travelled += center;
+}
+
+int16_t Odometry::xMm() const {
+  return (int16_t)(x >> 4);
+}
+
+int16_t Odometry::yMm() const {
+  return (int16_t)(y >> 4);
+}
+
+uint16_t Odometry::heading() const {
+  return theta;
+}
+
+int32_t Odometry::distance() const {
+  return travelled;
+}
+
+//==================== Intersection Map ===========================
+
+IntersectionMap::IntersectionMap() {
+  radius = 80;
+  clear();
+}
+
+void IntersectionMap::clear() {
+  nodeCount = 0;
+  revisitCount = 0;
+}
+
+uint8_t IntersectionMap::find(int16_t x, int16_t y) const {
+  for (uint8_t i = 0; i < nodeCount; i++) {
+    int16_t dx = nodes[i].x - x;
+    int16_t dy = nodes[i].y - y;
+    if (dx < 0) dx = -dx;
+    if (dy < 0) dy = -dy;
+    if (dx <= radius && dy <= radius) {
+      return i;
+    }
+  }
+  return NO_NODE;
+}
+
+uint8_t IntersectionMap::visit(int16_t x, int16_t y) {
+  uint8_t index = find(x, y);
+  if (index != NO_NODE) {
+    if (nodes[index].visits < 255) {
+      nodes[index].visits++;
+    }
+    revisitCount++;
+    return index;
+  }
+  if (nodeCount >= MAX_NODES) {
+    return NO_NODE;
+  }
+  nodes[nodeCount].x = x;
+  nodes[nodeCount].y = y;
+  nodes[nodeCount].visits = 1;
+  nodes[nodeCount].exits = 0;
+  return nodeCount++;
+}
+
+void IntersectionMap::addExits(uint8_t index, uint8_t mask) {
+  if (index < nodeCount) {
+    nodes[index].exits |= mask & 0x0F;
+  }
+}
+
+uint16_t IntersectionMap::distance(uint8_t a, uint8_t b) const {
+  if (a >= nodeCount || b >= nodeCount) {
+    return 0;
+  }
+  int16_t dx = nodes[a].x - nodes[b].x;
+  int16_t dy = nodes[a].y - nodes[b].y;
+  if (dx < 0) dx = -dx;
+  if (dy < 0) dy = -dy;
+  return dx + dy;
+}
+
+uint8_t IntersectionMap::count() const {
+  return nodeCount;
+}
+
+uint8_t IntersectionMap::revisits() const {
+  return revisitCount;
+}
+
+const MapNode& IntersectionMap::node(uint8_t index) const {
+  return nodes[index];
+}
@@ -0,0 +1,86 @@
+//===============================
+// Odometry
+// Encoder dead reckoning and a coordinate map of maze intersections.
+// Integer only, no Arduino headers.
+//===============================
+
+#ifndef ODOMETRY_H
+#define ODOMETRY_H
+
+#include <stdint.h>
+
+//Pose integrated from wheel encoder increments.
+//Origin is where reset() was called, facing +x. Heading is a binary
+//angle (65536 = 360 deg), counter-clockwise positive.
+class Odometry {
+public:
+  Odometry();
+
+  void reset();
+
+  //Integrate left/right tick increments since the last call.
+  void update(int16_t dL, int16_t dR);
+
+  int16_t xMm() const;
+  int16_t yMm() const;
+  uint16_t heading() const;
+
+  //Distance travelled by the robot center, in ticks (always increasing).
+  int32_t distance() const;
+
+private:
+  int32_t x; //1/16 mm
+  int32_t y; //1/16 mm
+  int32_t diffTicks; //accumulated right minus left
+  int32_t travelled;
+  uint16_t theta;
+};
+
+//One physical intersection, located by odometry.
+struct MapNode {
+  int16_t x; //mm
+  int16_t y; //mm
+  uint8_t visits;
+  uint8_t exits; //branches seen, one bit per direction, see MazeGraph
+};
+
+//Fixed-size list of intersections. A pose within `radius` of a known
+//node counts as a revisit of that node, which is how loops show up.
+//MAX_NODES covers the junctions of a contest maze, which stays well
+//under 32; junctions past that are simply not mapped.
+class IntersectionMap {
+public:
+  static const uint8_t MAX_NODES = 32;
+  static const uint8_t NO_NODE = 0xFF;
+
+  IntersectionMap();
+
+  void clear();
+
+  //Returns the index of the node at (x, y), adding it if it is new.
+  //Returns NO_NODE if the map is full.
+  uint8_t visit(int16_t x, int16_t y);
+
+  //Returns the node at (x, y) or NO_NODE.
+  uint8_t find(int16_t x, int16_t y) const;
+
+  //Adds to the exits seen at a node. Ignores NO_NODE.
+  void addExits(uint8_t index, uint8_t mask);
+
+  //Manhattan distance between two nodes in mm (maze segments are
+  //axis aligned). Returns 0 if either index is NO_NODE.
+  uint16_t distance(uint8_t a, uint8_t b) const;
+
+  uint8_t count() const;
+  uint8_t revisits() const;
+  const MapNode& node(uint8_t index) const;
+
+  int16_t radius; //mm
+
+private:
+  MapNode nodes[MAX_NODES];
+  uint8_t nodeCount;
+  uint8_t revisitCount;
+};
+
+#endif
@@ -0,0 +1,113 @@
+//===============================
+// SlipGuard
+// Wheel-slip detection and adaptive acceleration limit.
+//===============================
+
+#include "SlipGuard.h"
+#include <FixedPoint.h>
+
+static const uint8_t SPLIT_STEPS = 3;     //wheels apart this long is slip
+static const uint8_t HOLDOFF_STEPS = 20;  //one event per slip, not per step
+static const int16_t SPLIT_MIN_SPEED = 100; //mm/s, below this the split is noise
+static const int16_t RUNAWAY_Q8 = 128;      //share of the speed error closed in one step
+
+static int16_t absSpeed(int16_t v) {
+  return v < 0 ? -v : v;
+}
+
+//A wheel that changed speed by at least minChange in one step, and by
+//more than RUNAWAY_Q8 of what it was still short of its target. With
+//the robot to move, a wheel covers about a fifth in a 10 ms step.
+static bool runaway(int16_t target, int16_t prev, int16_t speed, int16_t minChange) {
+  int16_t change = absSpeed(speed - prev);
+  int16_t demand = absSpeed(target - prev);
+  return change >= minChange && ((int32_t)change << 8) > (int32_t)demand * RUNAWAY_Q8;
+}
+
+SlipGuard::SlipGuard() {
+  accelMax = 10000;
+  accelMin = 2000;
+  slipAccel = 20000;
+  backoffQ8 = 192;
+  reset();
+}
+
+void SlipGuard::reset() {
+  accel = 0;
+  turnScale = 256;
+  slips = 0;
+  restart();
+}
+
+void SlipGuard::restart() {
+  havePrev = false;
+  splitSteps = 0;
+  holdoff = 0;
+}
+
+bool SlipGuard::update(int16_t targetL, int16_t targetR, int16_t ticksL, int16_t ticksR, uint16_t dtMs) {
+  int16_t speedL = (int16_t)fx::ticksToMmPerSec(ticksL, dtMs);
+  int16_t speedR = (int16_t)fx::ticksToMmPerSec(ticksR, dtMs);
+  int16_t minChange = (int16_t)((uint32_t)slipAccel * dtMs / 1000);
+  bool slip = havePrev && (runaway(targetL, prevL, speedL, minChange) || runaway(targetR, prevR, speedR, minChange));
+  prevL = speedL;
+  prevR = speedR;
+  havePrev = true;
+
+  //same speed asked of both wheels, straight or pivoting
+  int16_t target = absSpeed(targetL);
+  if (target >= SPLIT_MIN_SPEED && target == absSpeed(targetR)) {
+    int16_t split = absSpeed(absSpeed(speedL) - absSpeed(speedR));
+    splitSteps = split * 4 > target ? splitSteps + 1 : 0;
+    if (splitSteps >= SPLIT_STEPS) {
+      slip = true;
+    }
+  }
+  else {
+    splitSteps = 0;
+  }
+
+  if (holdoff > 0) {
+    holdoff--;
+    return false;
+  }
+  return slip && slipped();
+}
+
+bool SlipGuard::slipped() {
+  if (holdoff > 0) {
+    return false;
+  }
+  holdoff = HOLDOFF_STEPS;
+  splitSteps = 0;
+  if (slips < 0xFFFF) {
+    slips++;
+  }
+  if (accel == 0) {
+    accel = accelMax;
+  }
+  else {
+    uint16_t lower = (uint16_t)(((uint32_t)accel * backoffQ8) >> 8);
+    accel = lower > accelMin ? lower : accelMin;
+  }
+  int16_t scale = (int16_t)(((int32_t)turnScale * backoffQ8) >> 8);
+  turnScale = scale > TURN_SCALE_MIN_Q8 ? scale : TURN_SCALE_MIN_Q8;
+  return true;
+}
+
+int16_t SlipGuard::ramp(int16_t current, int16_t target, uint16_t dtMs) const {
+  if (accel == 0) {
+    return target;
+  }
+  int32_t step = (int32_t)accel * dtMs / 1000;
+  if (step < 1) {
+    step = 1;
+  }
+  if (target > current + step) {
+    return (int16_t)(current + step);
+  }
+  if (target < current - step) {
+    return (int16_t)(current - step);
+  }
+  return target;
+}
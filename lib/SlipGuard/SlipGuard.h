@@ -0,0 +1,72 @@
+//===============================
+// SlipGuard
+// Wheel-slip detection and the acceleration limit it adapts. Runs in the
+// control interrupt next to the wheel speed loop.
+//
+// A wheel that breaks loose has lost the robot's inertia as its load and
+// closes its speed error far faster than a gripping one; a change of at
+// least slipAccel per second that also covers more than half the error
+// in one step is slip. In a straight run or a pivot both wheels are
+// asked for the same speed, so one of them falling well behind the other
+// is slip as well. Under the ramp the encoders follow the ramp whether
+// the tyres grip or not; the gyro still tells, and what it finds is
+// handed in through slipped().
+//
+// Targets pass unramped until the first slip event, which sets the
+// accelMax ramp. Every further event lowers it by backoffQ8 towards
+// accelMin, and every event slows the pivots the same way, until the
+// next reset(): the floor that slipped once will slip again, and the
+// encoder distances and turn angles are only worth anything while the
+// wheels grip.
+// Integer only, no Arduino headers.
+//===============================
+
+#ifndef SLIP_GUARD_H
+#define SLIP_GUARD_H
+
+#include <stdint.h>
+
+class SlipGuard {
+public:
+  static const int16_t TURN_SCALE_MIN_Q8 = 128; //half speed turns at worst
+
+  SlipGuard();
+
+  //No ramp, full turn speed and no slips, for a new run.
+  void reset();
+
+  //Starts again after the wheels were braked.
+  void restart();
+
+  //One step with the wheel targets in force (mm/s, after ramp()) and the
+  //ticks counted over dtMs. Returns true on a new slip event.
+  bool update(int16_t targetL, int16_t targetR, int16_t ticksL, int16_t ticksR, uint16_t dtMs);
+
+  //A slip found outside, e.g. by the gyro. Returns true if it counted as
+  //a new event.
+  bool slipped();
+
+  //current moved towards target by no more than the acceleration limit
+  //allows over dtMs.
+  int16_t ramp(int16_t current, int16_t target, uint16_t dtMs) const;
+
+  uint16_t accelLimit() const {return accel;} //mm/s^2, 0 = none
+  int16_t turnScaleQ8() const {return turnScale;}
+  uint16_t slipCount() const {return slips;}
+
+  uint16_t accelMax;  //mm/s^2, ramp set by the first slip; 0 = never ramp
+  uint16_t accelMin;  //mm/s^2, floor after more slips
+  uint16_t slipAccel; //mm/s^2, least wheel acceleration taken as slip
+  uint8_t backoffQ8;  //limits scale per slip event
+
+private:
+  int16_t prevL, prevR; //mm/s, last step's measured speeds
+  bool havePrev;
+  uint8_t splitSteps;   //consecutive steps with the wheels apart
+  uint8_t holdoff;      //steps before another event can count
+  uint16_t accel;
+  int16_t turnScale;
+  uint16_t slips;
+};
+
+#endif
@@ -0,0 +1,91 @@
+//===============================
+// Telemetry
+// Line-control frame packing and stream decoding.
+//===============================
+
+#include "Telemetry.h"
+
+static void put16(uint8_t* out, uint16_t v) {
+  out[0] = (uint8_t)v;
+  out[1] = (uint8_t)(v >> 8);
+}
+
+static uint16_t get16(const uint8_t* in) {
+  return (uint16_t)(in[0] | (in[1] << 8));
+}
+
+//Fletcher-16 over everything between the sync and the checksum
+static uint16_t checksum(const uint8_t* frame) {
+  uint16_t a = 0;
+  uint16_t b = 0;
+  for (uint8_t i = 2; i < telemetry::FRAME_BYTES - 2; i++) {
+    a = (a + frame[i]) % 255;
+    b = (b + a) % 255;
+  }
+  return (uint16_t)(b << 8 | a);
+}
+
+void telemetry::encode(const TelemetryFrame& frame, uint8_t* out) {
+  out[0] = SYNC0;
+  out[1] = SYNC1;
+  out[2] = frame.seq;
+  put16(out + 3, (uint16_t)frame.timeUs);
+  put16(out + 5, (uint16_t)(frame.timeUs >> 16));
+  for (uint8_t i = 0; i < 5; i++) {
+    put16(out + 7 + 2 * i, frame.vals[i]);
+  }
+  put16(out + 17, frame.predict);
+  put16(out + 19, (uint16_t)frame.deviation);
+  put16(out + 21, (uint16_t)frame.motorL);
+  put16(out + 23, (uint16_t)frame.motorR);
+  out[25] = (uint8_t)frame.decision;
+  out[26] = frame.flags;
+  put16(out + 27, checksum(out));
+}
+
+TelemetryDecoder::TelemetryDecoder() {
+  fill = 0;
+  bad = 0;
+}
+
+bool TelemetryDecoder::push(uint8_t byte) {
+  if (fill == 0 && byte != telemetry::SYNC0) {
+    return false;
+  }
+  if (fill == 1 && byte != telemetry::SYNC1) {
+    fill = byte == telemetry::SYNC0 ? 1 : 0;
+    return false;
+  }
+  buf[fill++] = byte;
+  if (fill < telemetry::FRAME_BYTES) {
+    return false;
+  }
+  fill = 0;
+
+  if (checksum(buf) != get16(buf + telemetry::FRAME_BYTES - 2)) {
+    //most likely a false sync in console text: look again from the
+    //byte after it. Fewer bytes than a frame, so no frame completes.
+    bad++;
+    uint8_t tail[telemetry::FRAME_BYTES - 1];
+    for (uint8_t i = 0; i < telemetry::FRAME_BYTES - 1; i++) {
+      tail[i] = buf[i + 1];
+    }
+    for (uint8_t i = 0; i < telemetry::FRAME_BYTES - 1; i++) {
+      push(tail[i]);
+    }
+    return false;
+  }
+
+  last.seq = buf[2];
+  last.timeUs = (uint32_t)get16(buf + 3) | ((uint32_t)get16(buf + 5) << 16);
+  for (uint8_t i = 0; i < 5; i++) {
+    last.vals[i] = get16(buf + 7 + 2 * i);
+  }
+  last.predict = get16(buf + 17);
+  last.deviation = (int16_t)get16(buf + 19);
+  last.motorL = (int16_t)get16(buf + 21);
+  last.motorR = (int16_t)get16(buf + 23);
+  last.decision = (char)buf[25];
+  last.flags = buf[26];
+  return true;
+}
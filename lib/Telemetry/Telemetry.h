@@ -0,0 +1,77 @@
+//===============================
+// Telemetry
+// Binary line-control frames streamed over USB serial while a run is
+// going, for the host capture tool in capture/. One frame per line
+// control step, fixed size, little-endian whatever the host:
+//
+//   0  sync 0xA5 0x5A
+//   2  seq        frame counter, gaps are frames the robot dropped
+//   3  timeUs     micros() of the sensor read
+//   7  vals[5]    calibrated sensor values, 0..1000
+//  17  predict    raw line position, 0..4000
+//  19  deviation  offset the PID worked on
+//  21  motorL, motorR  commands after the clamps
+//  25  decision   last intersection decision
+//  26  flags      TELEMETRY_* below
+//  27  checksum   Fletcher-16 of bytes 2..26
+//
+// Text from the console can sit between frames; the decoder skips it.
+// Integer only, no Arduino headers.
+//===============================
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdint.h>
+
+enum TelemetryFlags : uint8_t {
+  TELEMETRY_LEFT = 0x01,
+  TELEMETRY_CENTER = 0x02,
+  TELEMETRY_RIGHT = 0x04,
+  TELEMETRY_ON_LINE = 0x08,
+};
+
+struct TelemetryFrame {
+  uint8_t seq;
+  uint32_t timeUs;
+  uint16_t vals[5];
+  uint16_t predict;
+  int16_t deviation;
+  int16_t motorL;
+  int16_t motorR;
+  char decision;
+  uint8_t flags;
+};
+
+namespace telemetry {
+
+const uint8_t SYNC0 = 0xA5;
+const uint8_t SYNC1 = 0x5A;
+const uint8_t FRAME_BYTES = 29;
+
+//Packs frame into out[FRAME_BYTES].
+void encode(const TelemetryFrame& frame, uint8_t* out);
+
+} // namespace telemetry
+
+//Byte-at-a-time frame finder for the receiving end.
+class TelemetryDecoder {
+public:
+  TelemetryDecoder();
+
+  //Feeds one byte. Returns true when it completed a valid frame, which
+  //is then in frame().
+  bool push(uint8_t byte);
+
+  const TelemetryFrame& frame() const {return last;}
+
+  uint32_t badFrames() const {return bad;} //synced, wrong checksum
+
+private:
+  uint8_t buf[telemetry::FRAME_BYTES];
+  uint8_t fill;
+  uint32_t bad;
+  TelemetryFrame last;
+};
+
+#endif
@@ -0,0 +1,61 @@
+//===============================
+// WheelVelocity
+// Per-wheel feed-forward + PI velocity controller.
+//===============================
+
+#include "WheelVelocity.h"
+#include <FixedPoint.h>
+
+WheelVelocity::WheelVelocity() {
+  ffQ8 = fx::MOTOR_PER_MM_PER_SEC_Q8;
+  kpQ8 = 51;
+  kiQ16 = 65;
+  integralLimit = 200000;
+  reset();
+}
+
+void WheelVelocity::reset() {
+  integral = 0;
+  measured = 0;
+  correction = 0;
+}
+
+int16_t WheelVelocity::feedForward(int16_t target) const {
+  return (int16_t)(((int32_t)target * ffQ8) >> 8);
+}
+
+int16_t WheelVelocity::output(int16_t target) const {
+  int16_t out = feedForward(target) + correction;
+  if (out > 400) out = 400;
+  if (out < -400) out = -400;
+  return out;
+}
+
+int16_t WheelVelocity::update(int16_t target, int16_t ticks, uint16_t dtMs) {
+  //one-pole filter, the raw tick rate is coarse at 10 ms
+  int16_t raw = (int16_t)fx::ticksToMmPerSec(ticks, dtMs);
+  measured += (raw - measured) / 2;
+
+  int16_t error = target - measured;
+  int32_t out = (int32_t)feedForward(target);
+  out += ((int32_t)error * kpQ8) >> 8;
+
+  //integrate only while the output is not saturated (anti-windup)
+  int32_t next = integral + (int32_t)error * dtMs;
+  if (next > integralLimit) next = integralLimit;
+  if (next < -integralLimit) next = -integralLimit;
+  int32_t withI = out + ((next * kiQ16) >> 16);
+  if (withI <= 400 && withI >= -400) {
+    integral = next;
+  }
+  out += (integral * kiQ16) >> 16;
+
+  if (out > 400) out = 400;
+  if (out < -400) out = -400;
+  correction = (int16_t)out - feedForward(target);
+  return (int16_t)out;
+}
+
+int16_t WheelVelocity::speed() const {
+  return measured;
+}
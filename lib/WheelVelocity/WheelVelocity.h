@@ -0,0 +1,44 @@
+//===============================
+// WheelVelocity
+// Per-wheel velocity controller: feed-forward from the commanded speed
+// plus PI on the encoder-measured speed. Targets are in mm/s, the output
+// is a motor command (-400..400). Integer only, no Arduino headers.
+//===============================
+
+#ifndef WHEEL_VELOCITY_H
+#define WHEEL_VELOCITY_H
+
+#include <stdint.h>
+
+class WheelVelocity {
+public:
+  WheelVelocity();
+
+  //Clears the integrator and the speed estimate.
+  void reset();
+
+  //Runs one fixed-rate step with the ticks counted over dtMs.
+  //Returns the motor command.
+  int16_t update(int16_t target, int16_t ticks, uint16_t dtMs);
+
+  //Motor command for a new target set between steps: feed-forward
+  //plus the feedback correction from the last step.
+  int16_t output(int16_t target) const;
+
+  //Filtered measured speed, mm/s.
+  int16_t speed() const;
+
+  int16_t ffQ8;  //motor units per mm/s, Q8
+  int16_t kpQ8;  //motor units per mm/s of error, Q8
+  int16_t kiQ16; //motor units per (mm/s * ms) of accumulated error, Q16
+  int32_t integralLimit;
+
+private:
+  int16_t feedForward(int16_t target) const;
+
+  int32_t integral;
+  int16_t measured;
+  int16_t correction;
+};
+
+#endif
@@ -0,0 +1,79 @@
+# Static SRAM report, run by PlatformIO after the firmware is linked.
+#
+# Takes the .data, .bss and .noinit totals from avr-size, which counts
+# everything the linker placed there, string literals included, and
+# checks what is left against the 2.5 KB of the ATmega32U4. Symbols from
+# nm are only the breakdown: anonymous data such as .LC* string literals
+# has no symbol and shows up as the unnamed rest of its section. Set
+# MEMORY_REPORT_TOP to change how many symbols are listed (default 25,
+# 0 for all).
+
+import os
+import subprocess
+
+Import("env")
+
+SRAM_BYTES = 2560
+SRAM_SECTIONS = (".data", ".bss", ".noinit")
+#room to keep for the stack; the mem console command shows the real peak
+STACK_RESERVE = 512
+
+
+def section_sizes(size_tool, elf):
+    out = subprocess.check_output([size_tool, "-A", elf], universal_newlines=True)
+    sizes = dict((section, 0) for section in SRAM_SECTIONS)
+    for line in out.splitlines():
+        parts = line.split()
+        if len(parts) >= 2 and parts[0] in sizes:
+            sizes[parts[0]] = int(parts[1])
+    return sizes
+
+
+def symbol_sizes(nm, elf):
+    out = subprocess.check_output([nm, "-S", "-C", "--size-sort", elf], universal_newlines=True)
+    rows = []
+    for line in out.splitlines():
+        parts = line.split(None, 3)
+        if len(parts) < 4:
+            continue
+        size, kind, name = int(parts[1], 16), parts[2], parts[3]
+        if kind in "dD":
+            rows.append((size, ".data", name))
+        elif kind in "bB":
+            rows.append((size, ".bss", name))
+    return sorted(rows, reverse=True)
+
+
+def memory_report(source, target, env):
+    elf = str(target[0])
+    #avr-gcc -> avr-size and avr-nm from the same toolchain package
+    cc = env.subst("$CC")
+    sizes = section_sizes(cc.replace("gcc", "size"), elf)
+    rows = symbol_sizes(cc.replace("gcc", "nm"), elf)
+    top = int(os.environ.get("MEMORY_REPORT_TOP", "25"))
+
+    print("")
+    print("Static SRAM by symbol (%s):" % os.path.basename(elf))
+    print("%7s  %-7s %s" % ("bytes", "sect", "symbol"))
+    for size, section, name in rows[:top] if top else rows:
+        print("%7d  %-7s %s" % (size, section, name))
+    if top and len(rows) > top:
+        rest = sum(size for size, _, _ in rows[top:])
+        print("%7d  %-7s (%d more symbols)" % (rest, "", len(rows) - top))
+    for section in (".data", ".bss"):
+        named = sum(size for size, sect, _ in rows if sect == section)
+        if sizes[section] > named:
+            print("%7d  %-7s (unnamed: literals, padding)" % (sizes[section] - named, section))
+
+    used = 0
+    for section in SRAM_SECTIONS:
+        print("%7d  %s" % (sizes[section], section))
+        used += sizes[section]
+    left = SRAM_BYTES - used
+    print("%7d  left for heap and stack of %d" % (left, SRAM_BYTES))
+    if left < STACK_RESERVE:
+        print("WARNING: less than the %d B stack reserve left" % STACK_RESERVE)
+    print("")
+
+
+env.AddPostAction("$BUILD_DIR/${PROGNAME}.elf", memory_report)
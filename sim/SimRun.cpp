@@ -0,0 +1,623 @@
+//===============================
+// SimRun
+// The robot side of the maze runner over the simulated world.
+//===============================
+
+#include "SimRun.h"
+#include <stdlib.h>
+#include <random>
+
+namespace {
+
+//Robot-side execution times
+const uint32_t SENSOR_READ_US = 1000; //readCalibrated, emitters on
+const uint32_t LINE_LOOP_US = 1500;   //rest of a line loop, mostly OLED
+const uint32_t MOTION_LOOP_US = 500;  //one crawl or turn iteration
+const uint32_t GYRO_SAMPLE_US = 600;  //gyro output data rate
+
+const uint16_t midPoint = 2000;
+const uint8_t odomDiv = 10;           //control ticks (ms) per odometry step
+const int16_t headingHoldKp = 3;
+const uint16_t gyroCalSamples = 256;
+
+const double LOST_MM = 50;            //center this far from any line
+const uint32_t EXPLORE_BUDGET_MS = 180000;
+const uint32_t OPT_BUDGET_MS = 90000;
+
+int16_t clamp16(int32_t v, int16_t lo, int16_t hi) {
+  return v < lo ? lo : (v > hi ? hi : v);
+}
+
+}
+
+SimRun::SimRun(SimWorld& world)
+  : world(world), graph(intersections), nav(intersections, graph, optimizedPath, decisionCount) {
+}
+
+SimLap SimRun::run(const SimParams& params, uint32_t seed) {
+  p = params;
+  outcome = SIM_OK;
+  SimLap lap = {SIM_OK, 0, 0, 0, 0, false};
+
+  //per-robot variation
+  std::mt19937 rng(seed);
+  std::normal_distribution<double> unit(0.0, 1.0);
+  world.variation.gainL = 1 + 0.03 * unit(rng);
+  world.variation.gainR = 1 + 0.03 * unit(rng);
+  world.variation.gyroBias = 20 * unit(rng);
+  world.reset(rng());
+
+  cmdActive = ctrlActive = false;
+  targetL = targetR = 0;
+  rampL = rampR = 0;
+  wheelL.reset();
+  wheelR.reset();
+  slipGuard.accelMax = p.accmax;
+  slipGuard.accelMin = p.accmin;
+  slipGuard.slipAccel = p.slipacc;
+  slipGuard.reset();
+  ctrlPhase = 0;
+  tickPhaseUs = 0;
+  controlTicks = lineTick = 0;
+  ctrlCountsL = headCountsL = world.encoderLeft();
+  ctrlCountsR = headCountsR = world.encoderRight();
+  odometry.reset();
+  frame = Frame();
+  decisionCount = -1;
+  timedRun = false;
+
+  calibrateGyro();
+  nav.mapStart(pose());
+
+  uint32_t start = millis();
+  deadlineMs = start + EXPLORE_BUDGET_MS;
+  bool finished = explore();
+  lap.exploreMs = millis() - start;
+  lap.slips = slipGuard.slipCount();
+  if (!finished) {
+    lap.outcome = outcome;
+    return lap;
+  }
+  if (!world.atFinish()) {
+    lap.outcome = SIM_WRONG_FINISH;
+    return lap;
+  }
+
+  maze::optimizePath(decisionHistory, optimizedPath, decisionCount);
+
+  bool atStart = false;
+  if (p.postexps > 0 || p.postexpmm > 0) {
+    start = millis();
+    deadlineMs = start + p.postexps * 1000UL + EXPLORE_BUDGET_MS;
+    if (!postExplore()) {
+      lap.outcome = outcome == SIM_OK ? SIM_LOST : outcome;
+      return lap;
+    }
+    lap.exploreMs += millis() - start;
+    if (!world.atStart()) {
+      lap.outcome = SIM_WRONG_FINISH;
+      return lap;
+    }
+    atStart = true;
+  }
+
+  //placed back on the start during the countdown, or driven back
+  driveWheels(0, 0);
+  pause(3000);
+  if (atStart) {
+    //already there
+  }
+  else if (p.returnRun) {
+    start = millis();
+    deadlineMs = start + OPT_BUDGET_MS;
+    finished = runRoute(true);
+    if (!finished) {
+      lap.outcome = outcome;
+      return lap;
+    }
+    if (!world.atStart()) {
+      lap.outcome = SIM_WRONG_FINISH;
+      return lap;
+    }
+    pause(3000);
+  }
+  else {
+    world.restart();
+  }
+
+  start = millis();
+  deadlineMs = start + OPT_BUDGET_MS;
+  timedRun = true;
+  finished = runRoute(false);
+  lap.optMs = millis() - start;
+  lap.slips = slipGuard.slipCount();
+  lap.relocations = nav.relocations();
+  lap.routeLost = nav.routeLost();
+  if (!finished) {
+    lap.outcome = outcome;
+  }
+  else if (!world.atFinish()) {
+    lap.outcome = SIM_WRONG_FINISH;
+  }
+  return lap;
+}
+
+void SimRun::advance(uint32_t us) {
+  while (us > 0) {
+    uint32_t slice = 1000 - tickPhaseUs;
+    if (slice > us) {slice = us;}
+    world.step(slice);
+    us -= slice;
+    tickPhaseUs += slice;
+    if (tickPhaseUs >= 1000) {
+      tickPhaseUs = 0;
+      controlTick();
+      controlTicks++;
+    }
+  }
+  if (outcome != SIM_OK) {
+    return;
+  }
+  if (world.offLine() > LOST_MM) {
+    outcome = SIM_LOST;
+  }
+  else if (millis() > deadlineMs) {
+    outcome = SIM_TIMEOUT;
+  }
+}
+
+void SimRun::pause(uint16_t ms) {
+  advance((uint32_t)ms * 1000);
+}
+
+NavPose SimRun::pose() const {
+  return {odometry.distance(), odometry.xMm(), odometry.yMm(), odometry.heading()};
+}
+
+//==================== Maze Runs ==================================
+
+bool SimRun::explore() {
+  while (outcome == SIM_OK) {
+    straightSegment();
+    bool leftMem, centerMem, rightMem;
+    probeIntersection(leftMem, centerMem, rightMem);
+    JunctionAction action = searchRule(leftMem, centerMem, rightMem);
+    if (action.decision == 'F' || action.kind == DECISION_RECORDED) {
+      nav.mapArrive(action, {leftMem, centerMem, rightMem}, pose(), IntersectionMap::NO_NODE);
+    }
+    if (action.decision == 'F') {
+      return outcome == SIM_OK;
+    }
+
+    pause(100);
+    turnControl(action.decision);
+    driveWheels(0, 0);
+    pause(100);
+    nav.mapLeave(action.decision, pose());
+    handleDecision(action.decision, action.kind);
+  }
+  return false;
+}
+
+bool SimRun::runRoute(bool back) {
+  nav.routeStart(back, pose());
+  if (back) {
+    turnControl('U');
+    driveWheels(0, 0);
+    pause(100);
+    nav.mapLeave('U', pose());
+    resetLineControl();
+    do {
+      lineControlStep();
+    } while (outcome == SIM_OK && (frame.left || frame.right));
+  }
+
+  while (outcome == SIM_OK) {
+    straightSegment();
+    bool leftMem, centerMem, rightMem;
+    probeIntersection(leftMem, centerMem, rightMem);
+    JunctionAction action = searchRule(leftMem, centerMem, rightMem);
+    char decision = nav.routeStep(action, {leftMem, centerMem, rightMem}, pose());
+    if (decision == 'F') {
+      driveWheels(0, 0);
+      if (back) {
+        turnControl('U');
+        driveWheels(0, 0);
+      }
+      return outcome == SIM_OK;
+    }
+    if (decision == 0) {
+      driveWheels(0, 0);
+      outcome = SIM_LOST;
+      return false;
+    }
+
+    turnControl(decision);
+    driveWheels(0, 0);
+    pause(100);
+    nav.mapLeave(decision, pose());
+  }
+  return false;
+}
+
+//Probe crawl, side check, wheel alignment and center check
+void SimRun::probeIntersection(bool& leftMem, bool& centerMem, bool& rightMem) {
+  crawlStraight(p.crawlspd, p.crawlms);
+  updateSensors();
+  leftMem = frame.left;
+  rightMem = frame.right;
+
+  crawlStraight(p.alignspd, p.alignms);
+  driveWheels(0, 0);
+  pause(100);
+
+  updateSensors();
+  centerMem = frame.center || frame.vals[1] > p.linethr || frame.vals[3] > p.linethr;
+
+  //a misread intersection: one side branch goes unseen
+  bool junction = leftMem + centerMem + rightMem >= 2 && !(frame.left && frame.center && frame.right);
+  if (timedRun && junction && world.variation.glitch > 0 && world.chance(world.variation.glitch)) {
+    if (leftMem && (!rightMem || world.chance(0.5))) {
+      leftMem = false;
+    }
+    else {
+      rightMem = false;
+    }
+  }
+}
+
+JunctionAction SimRun::searchRule(bool leftMem, bool centerMem, bool rightMem) const {
+  Junction j = {leftMem, centerMem, rightMem};
+  bool finish = frame.left && frame.center && frame.right;
+  return maze::junctionAction(maze::junctionCode(j, finish, p.rightHand));
+}
+
+void SimRun::handleDecision(char decision, DecisionKind kind) {
+  if (kind != DECISION_RECORDED) {
+    return;
+  }
+  maze::storeDecision(decisionHistory, decisionCount, MAX_DECISIONS, decision);
+}
+
+//==================== Maze Map ==================================
+
+//Follows the line from the current node to the next one, taking lone
+//branches on the way. Returns that node, NO_NODE if lost.
+uint8_t SimRun::driveLink(uint8_t expected) {
+  if (nav.node() == nav.finishNode()) {
+    resetLineControl();
+    do {
+      lineControlStep();
+    } while (outcome == SIM_OK && (frame.left || frame.right));
+  }
+  while (outcome == SIM_OK) {
+    straightSegment();
+    bool leftMem, centerMem, rightMem;
+    probeIntersection(leftMem, centerMem, rightMem);
+    JunctionAction action = searchRule(leftMem, centerMem, rightMem);
+    if (action.decision == 'F' || action.kind == DECISION_RECORDED) {
+      return nav.mapArrive(action, {leftMem, centerMem, rightMem}, pose(), expected);
+    }
+    turnControl(action.decision);
+    driveWheels(0, 0);
+    pause(100);
+  }
+  return IntersectionMap::NO_NODE;
+}
+
+//Drives the shortest known route to target
+bool SimRun::driveTo(uint8_t target) {
+  while (nav.node() != target && outcome == SIM_OK) {
+    uint8_t expected;
+    char turn = nav.turnTowards(target, expected);
+    if (turn == 0) {
+      return false;
+    }
+    turnControl(turn);
+    driveWheels(0, 0);
+    pause(100);
+    nav.mapLeave(turn, pose());
+    driveLink(expected);
+  }
+  return outcome == SIM_OK;
+}
+
+//Explores exits that could still shorten the route, then drives to the
+//start and replaces the optimized path with the best route found
+bool SimRun::postExplore() {
+  uint32_t startMs = millis();
+  int32_t startDist = odometry.distance();
+  while (outcome == SIM_OK) {
+    if (p.postexps > 0 && millis() - startMs >= p.postexps * 1000UL) {break;}
+    if (p.postexpmm > 0 && fx::ticksToMm(odometry.distance() - startDist) >= p.postexpmm) {break;}
+    uint8_t node, dir;
+    if (nav.plan(node, dir) != PLAN_EXPLORE) {
+      break;
+    }
+    if (!driveTo(node)) {
+      break;
+    }
+    char turn = nav.turnOnto(dir);
+    turnControl(turn);
+    driveWheels(0, 0);
+    pause(100);
+    nav.mapLeave(turn, pose());
+    if (driveLink(IntersectionMap::NO_NODE) == IntersectionMap::NO_NODE) {
+      return false;
+    }
+  }
+
+  if (!driveTo(nav.startNode())) {
+    return false;
+  }
+  turnControl('U');
+  driveWheels(0, 0);
+
+  nav.takeBestRoute(decisionHistory, MAX_DECISIONS);
+  return outcome == SIM_OK;
+}
+
+//==================== Line Following =============================
+
+void SimRun::straightSegment() {
+  resetLineControl();
+  while (outcome == SIM_OK) {
+    lineControlStep();
+    if (!frame.center && frame.vals[1] < p.gapthr && frame.vals[3] < p.gapthr) {
+      if (recoverLine()) {
+        continue;
+      }
+      return;
+    }
+    else if (frame.left || frame.right) {
+      return;
+    }
+  }
+}
+
+bool SimRun::lineReacquired() const {
+  return frame.center || frame.vals[1] >= p.gapthr || frame.vals[3] >= p.gapthr;
+}
+
+bool SimRun::recoverLine() {
+  int16_t lost = lineControl.lastDeviation();
+  if (p.recdev == 0 || abs(lost) < p.recdev) {
+    return false;
+  }
+
+  int32_t window = fx::mmToTicks(p.lossmm);
+  int32_t start = odometry.distance();
+  while (odometry.distance() - start < window && outcome == SIM_OK) {
+    lineControlStep();
+    if (lineReacquired()) {
+      return true;
+    }
+  }
+
+  int32_t target = fx::degToBrad(p.recdeg);
+  uint32_t timeout = (uint32_t)p.recdeg * 80 / 9 * 256 / slipGuard.turnScaleQ8();
+  int32_t turned = 0;
+  updateHeading();
+  uint16_t last = headingFilter.heading();
+  int16_t speed = pivotSpeed();
+  if (lost > 0) {driveWheels(speed, -speed);}
+  else {driveWheels(-speed, speed);}
+  uint32_t t0 = millis();
+  while (millis() - t0 < timeout && abs(turned) < target && outcome == SIM_OK) {
+    updateSensors();
+    uint16_t now = headingFilter.heading();
+    turned += (int16_t)(now - last);
+    last = now;
+    if (lineReacquired()) {
+      resetLineControl();
+      return true;
+    }
+  }
+  driveWheels(0, 0);
+  int16_t back = fx::bradToDeg((int16_t)turned);
+  if (abs(back) > p.turnlead) {
+    turnBy(-back);
+  }
+  driveWheels(0, 0);
+  return false;
+}
+
+void SimRun::lineControlStep() {
+  while ((uint8_t)(controlTicks - lineTick) < p.lineperms) {
+    advance(1000 - tickPhaseUs);
+  }
+  lineTick = controlTicks;
+  updateSensors();
+  LineCommand cmd = lineControl.step(lineGains(), frame.predict - midPoint, frame.onLine, frame.sampleUs,
+    (uint32_t)world.timeUs(), world.encoderLeft(), world.encoderRight());
+  driveWheels(cmd.left, cmd.right);
+  advance(LINE_LOOP_US);
+}
+
+void SimRun::resetLineControl() {
+  lineControl.reset(lineGains(), world.encoderLeft(), world.encoderRight());
+}
+
+LineGains SimRun::lineGains() const {
+  return {p.speed, p.minspeed, p.kp, p.kd, p.clampq8, p.curveControl, p.latacc, p.ffgainq8,
+    p.estaq8, p.estbq8, p.leadus, p.lineperms};
+}
+
+void SimRun::updateSensors() {
+  uint32_t weighted = 0;
+  uint16_t sum = 0;
+  bool onLine = false;
+
+  serviceMotion();
+  advance(SENSOR_READ_US);
+  world.readLine(frame.vals);
+  frame.sampleUs = (uint32_t)world.timeUs();
+
+  for (uint8_t i = 0; i < 5; i++) {
+    uint16_t val = frame.vals[i];
+    if (val > 200) {
+      onLine = true;
+    }
+    if (val > 50) {
+      weighted += (uint32_t)val * (i * 1000);
+      sum += val;
+    }
+  }
+
+  if (!onLine) {
+    if (frame.predict < midPoint) {frame.predict = 0;}
+    else {frame.predict = 4000;}
+  }
+  else {
+    frame.predict = weighted / sum;
+  }
+
+  frame.onLine = onLine;
+  frame.left = frame.vals[0] > p.linethr;
+  frame.center = frame.vals[2] > p.linethr;
+  frame.right = frame.vals[4] > p.linethr;
+}
+
+//==================== Motion =====================================
+
+void SimRun::crawlStraight(int16_t speed, uint16_t ms) {
+  serviceMotion();
+  uint16_t target = headingFilter.heading();
+  uint32_t start = millis();
+  while (millis() - start < ms && outcome == SIM_OK) {
+    serviceMotion();
+    int16_t error = headingFilter.heading() - target;
+    int16_t adj = (int32_t)error * headingHoldKp / 256;
+    adj = clamp16(adj, -speed / 2, speed / 2);
+    driveWheels(speed + adj, speed - adj);
+    advance(MOTION_LOOP_US);
+  }
+}
+
+int16_t SimRun::pivotSpeed() const {
+  return fx::mulQ8(p.turnspd, slipGuard.turnScaleQ8());
+}
+
+void SimRun::turnBy(int16_t deg) {
+  int16_t mag = abs(deg);
+  int32_t target = fx::degToBrad(mag - p.turnlead);
+  uint32_t timeout = (uint32_t)mag * 40 / 9 * 256 / slipGuard.turnScaleQ8();
+  int32_t turned = 0;
+  int16_t speed = pivotSpeed();
+
+  updateHeading();
+  uint16_t last = headingFilter.heading();
+  if (deg > 0) {driveWheels(-speed, speed);}
+  else {driveWheels(speed, -speed);}
+
+  uint32_t start = millis();
+  while (millis() - start < timeout && outcome == SIM_OK) {
+    serviceMotion();
+    uint16_t now = headingFilter.heading();
+    turned += (int16_t)(now - last);
+    last = now;
+    if (abs(turned) >= target) {
+      break;
+    }
+    advance(MOTION_LOOP_US);
+  }
+}
+
+void SimRun::turnControl(char decision) {
+  pause(50);
+  switch (decision) {
+  case 'R':
+    turnBy(-90);
+    break;
+  case 'L':
+    turnBy(90);
+    break;
+  case 'U':
+    turnBy(-180);
+    break;
+  }
+}
+
+void SimRun::driveWheels(int16_t left, int16_t right) {
+  if (!p.velocityControl || (left == 0 && right == 0)) {
+    cmdActive = false;
+    world.setMotors(left, right);
+    return;
+  }
+  cmdActive = true;
+  targetL = fx::motorToMmPerSec(left);
+  targetR = fx::motorToMmPerSec(right);
+}
+
+//Pose and wheel speeds are kept by the control tick
+void SimRun::serviceMotion() {
+  updateHeading();
+}
+
+void SimRun::controlTick() {
+  bool odomDue = ++ctrlPhase >= odomDiv;
+  if (cmdActive && !ctrlActive) {
+    wheelL.reset();
+    wheelR.reset();
+    slipGuard.restart();
+    rampL = rampR = 0;
+  }
+  ctrlActive = cmdActive;
+  if (cmdActive) {
+    rampL = slipGuard.ramp(rampL, targetL, 1);
+    rampR = slipGuard.ramp(rampR, targetR, 1);
+  }
+
+  int16_t outL = wheelL.output(rampL);
+  int16_t outR = wheelR.output(rampR);
+  if (odomDue) {
+    ctrlPhase = 0;
+    int16_t countsL = world.encoderLeft();
+    int16_t countsR = world.encoderRight();
+    int16_t dL = countsL - ctrlCountsL;
+    int16_t dR = countsR - ctrlCountsR;
+    ctrlCountsL = countsL;
+    ctrlCountsR = countsR;
+    odometry.update(dL, dR);
+    if (cmdActive) {
+      outL = wheelL.update(rampL, dL, odomDiv);
+      outR = wheelR.update(rampR, dR, odomDiv);
+      slipGuard.update(rampL, rampR, dL, dR, odomDiv);
+    }
+  }
+
+  if (cmdActive) {
+    world.setMotors(outL, outR);
+  }
+}
+
+void SimRun::updateHeading() {
+  uint64_t now = world.timeUs();
+  uint64_t dt = now - headingTime;
+  headingTime = now;
+
+  int16_t countsL = world.encoderLeft();
+  int16_t countsR = world.encoderRight();
+  if (dt > 50000) {dt = 50000;}
+  headingFilter.update(world.gyroZ(), (uint16_t)dt, countsL - headCountsL, countsR - headCountsR);
+  headCountsL = countsL;
+  headCountsR = countsR;
+
+  if (p.slipdeg > 0 && abs(headingFilter.slipAngle()) >= fx::degToBrad(p.slipdeg)) {
+    headingFilter.clearSlipAngle();
+    slipGuard.slipped();
+  }
+}
+
+void SimRun::calibrateGyro() {
+  headingFilter.startCalibration();
+  for (uint16_t i = 0; i < gyroCalSamples; i++) {
+    world.step(GYRO_SAMPLE_US);
+    headingFilter.addCalibrationSample(world.gyroZ());
+  }
+  headingFilter.finishCalibration();
+  headingFilter.reset();
+  headingTime = world.timeUs();
+  headCountsL = world.encoderLeft();
+  headCountsR = world.encoderRight();
+}
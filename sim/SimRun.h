@@ -0,0 +1,167 @@
+//===============================
+// SimRun
+// One simulated maze lap: the exploration run followed by the optimized
+// run, optionally with post-finish exploration or the return to the
+// start in between. The decisions, the maze map and route, the line
+// follower's control law, odometry, heading and wheel speeds are the
+// real library code from lib/, the same the sketch runs. What is left here is the robot side of
+// mazeRunnerV2.cpp: the motion loops that drive, probe and turn, with
+// the sketch globals as members so each instance is independent.
+//===============================
+
+#ifndef SIM_RUN_H
+#define SIM_RUN_H
+
+#include <stdint.h>
+#include <FixedPoint.h>
+#include <Odometry.h>
+#include <HeadingFilter.h>
+#include <MazeDecision.h>
+#include <MazeGraph.h>
+#include <MazeNavigator.h>
+#include <WheelVelocity.h>
+#include <LineControl.h>
+#include <SlipGuard.h>
+#include "SimWorld.h"
+
+//Tunables, named and scaled as in the sketch's tuning console
+struct SimParams {
+  int16_t speed = 60;
+  int16_t minspeed = 35;
+  int16_t kp = 64;
+  int16_t kd = 256;
+  int16_t clampq8 = fx::Q8(0.7);
+  int16_t linethr = 700;
+  int16_t gapthr = 600;
+  int16_t crawlspd = 61;
+  int16_t crawlms = 38;
+  int16_t alignspd = 40;
+  int16_t alignms = 140;
+  int16_t turnspd = 96;
+  int16_t turnlead = 6;
+  int16_t latacc = 3000;
+  int16_t ffgainq8 = 256;
+  int16_t lineperms = 3;
+  bool rightHand = true;
+  bool velocityControl = true;
+  bool curveControl = true;
+  int16_t postexps = 0;   //post-finish exploration budgets, 0 = none
+  int16_t postexpmm = 0;
+  bool returnRun = false; //drive back to the start instead of being carried
+  int16_t recdev = 1000;  //line loss recovery, 0 = stage off
+  int16_t lossmm = 20;
+  int16_t recdeg = 30;
+  int16_t estaq8 = 160;   //line estimator, 0 = raw reads
+  int16_t estbq8 = 32;
+  int16_t leadus = 1500;
+  int16_t accmax = 10000; //wheel slip limits, mm/s^2
+  int16_t accmin = 2000;
+  int16_t slipacc = 20000;
+  int16_t slipdeg = 8;    //gyro slip check, 0 = off
+};
+
+enum SimOutcome : uint8_t {
+  SIM_OK,
+  SIM_LOST,         //robot left the line
+  SIM_TIMEOUT,      //no finish within the time budget
+  SIM_WRONG_FINISH, //finish detected away from the finish square
+};
+
+struct SimLap {
+  SimOutcome outcome;
+  uint32_t exploreMs;
+  uint32_t optMs; //the lap time being tuned
+  uint16_t slips; //SlipGuard events over both runs
+  uint16_t relocations; //optimized run: route picked up off its next node
+  bool routeLost;       //optimized run: fell back to the search rule
+};
+
+class SimRun {
+public:
+  //world must have a maze loaded and outlive the run
+  explicit SimRun(SimWorld& world);
+
+  //Runs one full lap with params. seed picks the robot variation and
+  //sensor noise.
+  SimLap run(const SimParams& params, uint32_t seed);
+
+private:
+  struct Frame {
+    uint16_t vals[5];
+    uint16_t predict;
+    bool left, center, right, onLine;
+    uint32_t sampleUs;
+  };
+
+  //sketch functions, same behavior
+  bool explore();
+  bool runRoute(bool back);
+  void straightSegment();
+  bool lineReacquired() const;
+  bool recoverLine();
+  void lineControlStep();
+  void resetLineControl();
+  LineGains lineGains() const;
+  void updateSensors();
+  void probeIntersection(bool& leftMem, bool& centerMem, bool& rightMem);
+  void crawlStraight(int16_t speed, uint16_t ms);
+  int16_t pivotSpeed() const;
+  void turnBy(int16_t deg);
+  void turnControl(char decision);
+  JunctionAction searchRule(bool leftMem, bool centerMem, bool rightMem) const;
+  void handleDecision(char decision, DecisionKind kind);
+  bool postExplore();
+  bool driveTo(uint8_t target);
+  uint8_t driveLink(uint8_t expected);
+  void driveWheels(int16_t left, int16_t right);
+  void serviceMotion();
+  void controlTick();
+  void updateHeading();
+  void calibrateGyro();
+  void pause(uint16_t ms);
+  NavPose pose() const;
+
+  //time passes on the robot, with a control tick every ms; flags failures
+  void advance(uint32_t us);
+  uint32_t millis() const {return (uint32_t)(world.timeUs() / 1000);}
+
+  static const int MAX_DECISIONS = 100;
+
+  SimWorld& world;
+  SimParams p;
+  SimOutcome outcome;
+  uint32_t deadlineMs;
+
+  Odometry odometry;
+  IntersectionMap intersections;
+  HeadingFilter headingFilter;
+  int16_t headCountsL, headCountsR;
+  uint64_t headingTime;
+
+  //control interrupt, run inline between physics slices, so the
+  //sketch's double buffers reduce to plain members
+  WheelVelocity wheelL, wheelR;
+  SlipGuard slipGuard;
+  bool cmdActive;
+  int16_t targetL, targetR;
+  int16_t rampL, rampR;
+  bool ctrlActive;
+  uint8_t ctrlPhase;
+  int16_t ctrlCountsL, ctrlCountsR;
+  uint32_t tickPhaseUs;
+  uint8_t controlTicks;
+  uint8_t lineTick;
+
+  Frame frame;
+  LineControl lineControl;
+
+  MazeGraph graph;
+
+  char decisionHistory[MAX_DECISIONS];
+  char optimizedPath[MAX_DECISIONS];
+  int decisionCount;
+  MazeNavigator nav;
+  bool timedRun; //probes may glitch, see SimVariation
+};
+
+#endif
@@ -0,0 +1,245 @@
+//===============================
+// SimWorld
+// Host model of the 3pi+ on a line maze.
+//===============================
+
+#include "SimWorld.h"
+#include <FixedPoint.h>
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+const double LINE_HALF_MM = 9.5;   //19 mm electrical tape
+const double EDGE_MM = 6.0;        //sensor footprint, blurs the line edge
+const double SENSOR_AHEAD_MM = 30; //sensor row ahead of the axle
+const double SENSOR_Y_MM[5] = {30, 15, 0, -15, -30}; //left to right
+const double MOTOR_TAU_S = 0.05;   //wheel speed lag under drive
+const double BRAKE_TAU_S = 0.015;  //zero command brakes the motor
+const double FREE_TAU_S = 0.015;   //slipping wheel, only its own inertia
+const double GYRO_LSB_DPS = 0.07;
+const double FINISH_HALF_MM = 50;
+
+double segmentDistance(const SimSegment& s, double px, double py) {
+  double dx = s.x1 - s.x0;
+  double dy = s.y1 - s.y0;
+  double len2 = dx * dx + dy * dy;
+  double t = len2 > 0 ? ((px - s.x0) * dx + (py - s.y0) * dy) / len2 : 0;
+  t = std::min(1.0, std::max(0.0, t));
+  double ex = s.x0 + t * dx - px;
+  double ey = s.y0 + t * dy - py;
+  return std::sqrt(ex * ex + ey * ey);
+}
+
+}
+
+bool SimWorld::loadMaze(const std::vector<std::string>& rows, double cellMm, double cornerMm) {
+  segments.clear();
+  bool haveStart = false;
+  bool haveFinish = false;
+  finishHalf = FINISH_HALF_MM;
+  cornerMm = std::min(cornerMm, cellMm / 2 - LINE_HALF_MM);
+
+  auto at = [&](size_t r, size_t c) -> char {
+    if (r >= rows.size() || c >= rows[r].size()) {return ' ';}
+    return rows[r][c];
+  };
+  auto nodeX = [&](size_t c) {return (double)(c / 2) * cellMm;};
+  auto nodeY = [&](size_t r) {return -(double)(r / 2) * cellMm;};
+
+  //a plain node with exactly one horizontal and one vertical line is a
+  //corner; its direction vectors are returned in ux/uy
+  auto corner = [&](size_t r, size_t c, double& ux, double& uy, double& vx, double& vy) {
+    if (cornerMm <= 0 || at(r, c) != '+') {return false;}
+    bool right = at(r, c + 1) == '-';
+    bool left = c > 0 && at(r, c - 1) == '-';
+    bool up = r > 0 && at(r - 1, c) == '|';
+    bool down = at(r + 1, c) == '|';
+    if (right == left || up == down) {return false;}
+    ux = right ? 1 : -1;
+    uy = 0;
+    vx = 0;
+    vy = up ? 1 : -1;
+    return true;
+  };
+  double ux, uy, vx, vy;
+  auto trim = [&](size_t r, size_t c) {return corner(r, c, ux, uy, vx, vy) ? cornerMm : 0.0;};
+
+  for (size_t r = 0; r < rows.size(); r++) {
+    for (size_t c = 0; c < rows[r].size(); c++) {
+      char ch = rows[r][c];
+      if (ch == '-' && r % 2 == 0 && c % 2 == 1) {
+        segments.push_back({nodeX(c - 1) + trim(r, c - 1), nodeY(r), nodeX(c + 1) - trim(r, c + 1), nodeY(r)});
+      }
+      else if (ch == '|' && r % 2 == 1 && c % 2 == 0) {
+        segments.push_back({nodeX(c), nodeY(r - 1) - trim(r - 1, c), nodeX(c), nodeY(r + 1) + trim(r + 1, c)});
+      }
+      else if (r % 2 == 0 && c % 2 == 0 && corner(r, c, ux, uy, vx, vy)) {
+        //quarter circle tangent to both lines, as a polyline
+        double cx = nodeX(c) + cornerMm * (ux + vx);
+        double cy = nodeY(r) + cornerMm * (uy + vy);
+        double px = nodeX(c) + cornerMm * ux;
+        double py = nodeY(r) + cornerMm * uy;
+        const int pieces = 8;
+        for (int i = 1; i <= pieces; i++) {
+          double t = M_PI / 2 * i / pieces;
+          double qx = cx - cornerMm * (vx * std::cos(t) + ux * std::sin(t));
+          double qy = cy - cornerMm * (vy * std::cos(t) + uy * std::sin(t));
+          segments.push_back({px, py, qx, qy});
+          px = qx;
+          py = qy;
+        }
+      }
+      else if (ch == 'S' && r % 2 == 0 && c % 2 == 0) {
+        //heading along the start node's only line
+        startX = nodeX(c);
+        startY = nodeY(r);
+        if (at(r, c + 1) == '-') {startTheta = 0;}
+        else if (at(r, c - 1) == '-') {startTheta = M_PI;}
+        else if (r > 0 && at(r - 1, c) == '|') {startTheta = M_PI / 2;}
+        else {startTheta = -M_PI / 2;}
+        haveStart = true;
+      }
+      else if (ch == 'F' && r % 2 == 0 && c % 2 == 0) {
+        finishX = nodeX(c);
+        finishY = nodeY(r);
+        haveFinish = true;
+      }
+    }
+  }
+  return haveStart && haveFinish && !segments.empty();
+}
+
+void SimWorld::reset(uint32_t seed) {
+  rng.seed(seed);
+  posL = posR = 0;
+  time = 0;
+  restart();
+}
+
+void SimWorld::restart() {
+  x = startX;
+  y = startY;
+  theta = startTheta;
+  vL = vR = 0;
+  gL = gR = 0;
+  cmdL = cmdR = 0;
+}
+
+void SimWorld::setMotors(int16_t left, int16_t right) {
+  cmdL = std::max<int16_t>(-400, std::min<int16_t>(400, left));
+  cmdR = std::max<int16_t>(-400, std::min<int16_t>(400, right));
+}
+
+void SimWorld::step(uint32_t dtUs) {
+  //integrate in 1 ms slices so long pauses stay accurate
+  while (dtUs > 0) {
+    uint32_t slice = std::min<uint32_t>(dtUs, 1000);
+    double dt = slice * 1e-6;
+    double targetL = cmdL * fx::MM_PER_SEC_AT_400 / 400 * variation.gainL;
+    double targetR = cmdR * fx::MM_PER_SEC_AT_400 / 400 * variation.gainR;
+    wheel(targetL, cmdL, dt, vL, gL);
+    wheel(targetR, cmdR, dt, vR, gR);
+
+    double v = (gL + gR) / 2;
+    double w = (gR - gL) / fx::TRACK_MM;
+    x += v * std::cos(theta + w * dt / 2) * dt;
+    y += v * std::sin(theta + w * dt / 2) * dt;
+    theta += w * dt;
+    posL += vL * dt / fx::MM_PER_TICK;
+    posR += vR * dt / fx::MM_PER_TICK;
+
+    time += slice;
+    dtUs -= slice;
+  }
+}
+
+//One wheel's rim speed v towards target, and its ground speed g. The
+//ground speed follows the rim at no more than the grip allows; a rim
+//that got away from it carries only its own inertia and runs freely
+//until the two match again.
+void SimWorld::wheel(double target, int16_t cmd, double dt, double& v, double& g) const {
+  double tau = cmd == 0 ? BRAKE_TAU_S : MOTOR_TAU_S;
+  if (v != g) {
+    tau = std::min(tau, FREE_TAU_S);
+  }
+  v += (target - v) * (1 - std::exp(-dt / tau));
+  double step = variation.grip * dt;
+  if (variation.grip <= 0 || std::fabs(v - g) <= step) {
+    g = v;
+  }
+  else {
+    g += v > g ? step : -step;
+  }
+}
+
+int16_t SimWorld::encoderLeft() const {
+  return (int16_t)(int32_t)std::floor(posL);
+}
+
+int16_t SimWorld::encoderRight() const {
+  return (int16_t)(int32_t)std::floor(posR);
+}
+
+int16_t SimWorld::gyroZ() {
+  double dps = (gR - gL) / fx::TRACK_MM * 180 / M_PI;
+  double lsb = dps / GYRO_LSB_DPS + variation.gyroBias + gauss(3);
+  return (int16_t)std::max(-32768.0, std::min(32767.0, std::round(lsb)));
+}
+
+void SimWorld::readLine(uint16_t vals[5]) {
+  double c = std::cos(theta);
+  double s = std::sin(theta);
+  for (uint8_t i = 0; i < 5; i++) {
+    double sx = x + SENSOR_AHEAD_MM * c - SENSOR_Y_MM[i] * s;
+    double sy = y + SENSOR_AHEAD_MM * s + SENSOR_Y_MM[i] * c;
+    double d = lineDistance(sx, sy);
+    double cover = (LINE_HALF_MM + EDGE_MM / 2 - d) / EDGE_MM;
+    cover = std::min(1.0, std::max(0.0, cover));
+    double val = cover * 1000 + gauss(variation.sensorNoise);
+    vals[i] = (uint16_t)std::min(1000.0, std::max(0.0, val));
+  }
+}
+
+double SimWorld::lineDistance(double px, double py) const {
+  double best = 1e9;
+  for (const SimSegment& s : segments) {
+    best = std::min(best, segmentDistance(s, px, py));
+  }
+  //the finish square, as an equivalent distance from a line center so
+  //its edge blurs like a line edge
+  double ox = std::fabs(px - finishX) - finishHalf;
+  double oy = std::fabs(py - finishY) - finishHalf;
+  double finish;
+  if (ox <= 0 && oy <= 0) {
+    finish = std::max(0.0, LINE_HALF_MM + std::max(ox, oy));
+  }
+  else {
+    ox = std::max(ox, 0.0);
+    oy = std::max(oy, 0.0);
+    finish = LINE_HALF_MM + std::sqrt(ox * ox + oy * oy);
+  }
+  return std::min(best, finish);
+}
+
+double SimWorld::offLine() const {
+  return lineDistance(x, y);
+}
+
+bool SimWorld::atFinish() const {
+  return std::fabs(x - finishX) <= finishHalf && std::fabs(y - finishY) <= finishHalf;
+}
+
+bool SimWorld::atStart() const {
+  return std::hypot(x - startX, y - startY) <= 60;
+}
+
+bool SimWorld::chance(double p) {
+  std::uniform_real_distribution<double> u(0.0, 1.0);
+  return u(rng) < p;
+}
+
+double SimWorld::gauss(double sigma) {
+  std::normal_distribution<double> n(0.0, sigma);
+  return n(rng);
+}
@@ -0,0 +1,89 @@
+//===============================
+// SimWorld
+// Host model of the 3pi+ on a line maze: differential-drive kinematics
+// with first-order motor lag, wheel slip past a traction limit,
+// quantized encoders, a noisy z gyro and the five reflectance sensors. Each instance owns its maze, robot state and
+// random generator, so any number can run side by side on threads.
+//===============================
+
+#ifndef SIM_WORLD_H
+#define SIM_WORLD_H
+
+#include <stdint.h>
+#include <random>
+#include <string>
+#include <vector>
+
+//Line segment between two maze nodes, mm
+struct SimSegment {
+  double x0, y0, x1, y1;
+};
+
+//Per-robot physical variation, drawn once per lap
+struct SimVariation {
+  double gainL = 1.0;  //wheel speed per command, relative to nominal
+  double gainR = 1.0;
+  double gyroBias = 0;  //LSB
+  double sensorNoise = 25; //calibrated units, 1 sigma
+  double grip = 0;      //mm/s^2 a wheel can accelerate the robot by, 0 = no slip
+  double glitch = 0;    //chance a timed-run probe misses a side branch
+};
+
+class SimWorld {
+public:
+  //Maze rows use '+' for a node, '-' and '|' for lines between nodes,
+  //'S' for the start (a dead end) and 'F' for the finish square.
+  //Nodes are cellMm apart. With cornerMm set, plain corners become
+  //arcs of that radius, which the robot follows as curved line.
+  bool loadMaze(const std::vector<std::string>& rows, double cellMm, double cornerMm = 0);
+
+  //Reseeds the noise and puts the robot on the start node facing
+  //along its only line, with the clock at zero.
+  void reset(uint32_t seed);
+
+  //Carries the robot back to the start. Time and encoders run on.
+  void restart();
+
+  //Advances the physics by dtUs with the current motor commands.
+  void step(uint32_t dtUs);
+
+  //Motor command per wheel, -400..400
+  void setMotors(int16_t left, int16_t right);
+
+  int16_t encoderLeft() const;
+  int16_t encoderRight() const;
+  int16_t gyroZ();              //0.07 dps/LSB
+  void readLine(uint16_t vals[5]); //calibrated, line = 1000
+
+  uint64_t timeUs() const {return time;}
+  //Distance from the robot center to the nearest line, mm
+  double offLine() const;
+  bool atFinish() const;
+  //Near the start node, allowing for the probe crawl past its dead end
+  bool atStart() const;
+
+  //True with probability p, drawn from the noise generator
+  bool chance(double p);
+
+  SimVariation variation;
+
+private:
+  void wheel(double target, int16_t cmd, double dt, double& v, double& g) const;
+  double lineDistance(double x, double y) const;
+  double gauss(double sigma);
+
+  std::vector<SimSegment> segments;
+  double startX = 0, startY = 0, startTheta = 0;
+  double finishX = 0, finishY = 0;
+  double finishHalf = 0;
+
+  double x = 0, y = 0, theta = 0; //mm, rad
+  double vL = 0, vR = 0;          //mm/s, wheel rims, what the encoders count
+  double gL = 0, gR = 0;          //mm/s, wheel contact over the floor
+  double posL = 0, posR = 0;      //ticks
+  int16_t cmdL = 0, cmdR = 0;
+  uint64_t time = 0;
+  std::mt19937 rng;
+};
+
+#endif
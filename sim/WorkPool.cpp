@@ -0,0 +1,66 @@
+//===============================
+// WorkPool
+// Work-stealing thread pool for the parameter sweep.
+//===============================
+
+#include "WorkPool.h"
+#include <thread>
+
+WorkPool::WorkPool(unsigned threads) {
+  threadCount = threads ? threads : std::thread::hardware_concurrency();
+  if (threadCount == 0) {
+    threadCount = 1;
+  }
+  for (unsigned i = 0; i < threadCount; i++) {
+    queues.emplace_back(new Queue);
+  }
+}
+
+void WorkPool::run(size_t count, const std::function<void(size_t, unsigned)>& job) {
+  //deal contiguous blocks so neighbouring jobs start on the same worker
+  for (unsigned w = 0; w < threadCount; w++) {
+    size_t first = count * w / threadCount;
+    size_t last = count * (w + 1) / threadCount;
+    for (size_t i = first; i < last; i++) {
+      queues[w]->jobs.push_back(i);
+    }
+  }
+
+  //no job adds jobs, so a worker that finds every deque empty is done
+  std::vector<std::thread> workers;
+  for (unsigned w = 0; w < threadCount; w++) {
+    workers.emplace_back([this, w, &job]() {
+      size_t index;
+      while (popLocal(w, index) || steal(w, index)) {
+        job(index, w);
+      }
+    });
+  }
+  for (std::thread& t : workers) {
+    t.join();
+  }
+}
+
+bool WorkPool::popLocal(unsigned worker, size_t& index) {
+  Queue& q = *queues[worker];
+  std::lock_guard<std::mutex> guard(q.lock);
+  if (q.jobs.empty()) {
+    return false;
+  }
+  index = q.jobs.back();
+  q.jobs.pop_back();
+  return true;
+}
+
+bool WorkPool::steal(unsigned worker, size_t& index) {
+  for (unsigned i = 1; i < threadCount; i++) {
+    Queue& q = *queues[(worker + i) % threadCount];
+    std::lock_guard<std::mutex> guard(q.lock);
+    if (!q.jobs.empty()) {
+      index = q.jobs.front();
+      q.jobs.pop_front();
+      return true;
+    }
+  }
+  return false;
+}
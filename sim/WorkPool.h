@@ -0,0 +1,45 @@
+//===============================
+// WorkPool
+// Fixed set of worker threads with one job deque each. A worker takes
+// jobs from the back of its own deque and, once that is empty, steals
+// from the front of the others, so uneven job lengths (a lap that
+// fails after 2 s next to one that runs 90 s) still keep every core
+// busy until the end.
+//===============================
+
+#ifndef WORK_POOL_H
+#define WORK_POOL_H
+
+#include <stddef.h>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+class WorkPool {
+public:
+  //threads = 0 uses one per hardware thread
+  explicit WorkPool(unsigned threads);
+
+  unsigned size() const {return threadCount;}
+
+  //Runs job(index, worker) for every index in [0, count) and returns
+  //when all are done. worker is the index of the calling thread, so a
+  //job can use per-worker state without locking.
+  void run(size_t count, const std::function<void(size_t, unsigned)>& job);
+
+private:
+  struct Queue {
+    std::mutex lock;
+    std::deque<size_t> jobs;
+  };
+
+  bool popLocal(unsigned worker, size_t& index);
+  bool steal(unsigned worker, size_t& index);
+
+  unsigned threadCount;
+  std::vector<std::unique_ptr<Queue>> queues;
+};
+
+#endif
@@ -0,0 +1,338 @@
+//===============================
+// sweep
+// Host parameter sweep for the maze runner. Every combination of the
+// given parameter ranges is run for a number of simulated laps, spread
+// over all cores, and the Pareto front of optimized-run lap time
+// against failure rate is printed.
+//
+// Build and run with PlatformIO:
+//   pio run -e sweep
+//   .pio/build/sweep/program kp=32:128:16 kd=128:512:64 speed=60:120:20
+//
+// Options:
+//   name=lo:hi:step  sweep a parameter (names as in the serial console)
+//   name=value       fix a parameter
+//   --laps N         laps per combination, each with its own robot (20)
+//   --threads N      worker threads (all hardware threads)
+//   --seed N         base seed (1)
+//   --left           left-hand rule (right-hand by default, as the sketch)
+//   --return         drive back to the start before the optimized run
+//   --maze FILE      maze drawing, see SimWorld.h (built-in maze)
+//   --cell MM        node spacing (250)
+//   --corner MM      round plain corners to this radius (0)
+//   --grip MM        wheel traction limit in mm/s^2, slips past it (none)
+//   --glitch P       chance a timed-run probe misses a side branch (0)
+//   --all            print every combination, not just the front
+//===============================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <vector>
+#include "SimRun.h"
+#include "SimWorld.h"
+#include "WorkPool.h"
+
+namespace {
+
+//Tree maze with corners, T junctions, dead ends and a pass-through node
+const std::vector<std::string> defaultMaze = {
+  "S-+-+-+ +",
+  "  |   | |",
+  "+-+-+ +-+",
+  "|   |   |",
+  "+ +-+-+ +",
+  "|   |   |",
+  "+-+ + +-F",
+};
+
+struct ParamDef {
+  const char* name;
+  int16_t SimParams::*field;
+};
+
+const ParamDef paramDefs[] = {
+  {"speed", &SimParams::speed},
+  {"minspeed", &SimParams::minspeed},
+  {"kp", &SimParams::kp},
+  {"kd", &SimParams::kd},
+  {"clampq8", &SimParams::clampq8},
+  {"linethr", &SimParams::linethr},
+  {"gapthr", &SimParams::gapthr},
+  {"crawlspd", &SimParams::crawlspd},
+  {"crawlms", &SimParams::crawlms},
+  {"alignspd", &SimParams::alignspd},
+  {"alignms", &SimParams::alignms},
+  {"turnspd", &SimParams::turnspd},
+  {"turnlead", &SimParams::turnlead},
+  {"latacc", &SimParams::latacc},
+  {"ffgainq8", &SimParams::ffgainq8},
+  {"lineperms", &SimParams::lineperms},
+  {"postexps", &SimParams::postexps},
+  {"postexpmm", &SimParams::postexpmm},
+  {"recdev", &SimParams::recdev},
+  {"lossmm", &SimParams::lossmm},
+  {"recdeg", &SimParams::recdeg},
+  {"estaq8", &SimParams::estaq8},
+  {"estbq8", &SimParams::estbq8},
+  {"leadus", &SimParams::leadus},
+  {"accmax", &SimParams::accmax},
+  {"accmin", &SimParams::accmin},
+  {"slipacc", &SimParams::slipacc},
+  {"slipdeg", &SimParams::slipdeg},
+};
+
+struct Range {
+  const ParamDef* def;
+  int lo, hi, step;
+};
+
+//Per-combination totals
+struct Summary {
+  SimParams params;
+  unsigned laps = 0;
+  unsigned failures = 0;
+  unsigned lost = 0, timeouts = 0, wrongFinish = 0;
+  double optMs = 0;     //mean over successful laps
+  double exploreMs = 0;
+  double slips = 0;     //mean per lap
+  double relocations = 0; //mean per lap
+  unsigned ruleLaps = 0;  //timed runs that lost the route
+};
+
+const ParamDef* findParam(const char* name) {
+  for (const ParamDef& d : paramDefs) {
+    if (strcmp(d.name, name) == 0) {
+      return &d;
+    }
+  }
+  return nullptr;
+}
+
+//name=lo:hi:step or name=value
+bool parseRange(const char* arg, Range& r) {
+  char name[16];
+  const char* eq = strchr(arg, '=');
+  if (!eq || eq - arg >= (long)sizeof(name)) {
+    return false;
+  }
+  memcpy(name, arg, eq - arg);
+  name[eq - arg] = 0;
+  r.def = findParam(name);
+  if (!r.def) {
+    return false;
+  }
+  int n = sscanf(eq + 1, "%d:%d:%d", &r.lo, &r.hi, &r.step);
+  if (n == 1) {
+    r.hi = r.lo;
+    r.step = 1;
+  }
+  else if (n != 3 || r.step <= 0 || r.hi < r.lo) {
+    return false;
+  }
+  return true;
+}
+
+bool loadMazeFile(const char* path, std::vector<std::string>& rows) {
+  std::ifstream in(path);
+  std::string line;
+  while (std::getline(in, line)) {
+    rows.push_back(line);
+  }
+  return !rows.empty();
+}
+
+//Every combination of the ranges, on top of the sketch defaults
+std::vector<SimParams> expand(const std::vector<Range>& ranges, const SimParams& base) {
+  std::vector<SimParams> combos = {base};
+  for (const Range& r : ranges) {
+    std::vector<SimParams> next;
+    for (const SimParams& c : combos) {
+      for (int v = r.lo; v <= r.hi; v += r.step) {
+        SimParams s = c;
+        s.*(r.def->field) = (int16_t)v;
+        next.push_back(s);
+      }
+    }
+    combos.swap(next);
+  }
+  return combos;
+}
+
+double failRate(const Summary& s) {
+  return s.laps ? (double)s.failures / s.laps : 1;
+}
+
+double lapTime(const Summary& s) {
+  return s.failures < s.laps ? s.optMs : std::numeric_limits<double>::infinity();
+}
+
+//True if a is at least as good as b on both axes and better on one
+bool dominates(const Summary& a, const Summary& b) {
+  double fa = failRate(a), fb = failRate(b);
+  double ta = lapTime(a), tb = lapTime(b);
+  return fa <= fb && ta <= tb && (fa < fb || ta < tb);
+}
+
+void printTable(const std::vector<const Summary*>& rows, const std::vector<Range>& ranges) {
+  for (const Range& r : ranges) {
+    printf("%10s", r.def->name);
+  }
+  printf("  %7s %9s %9s %5s %5s %5s %6s %6s %5s\n", "fail%", "lap_ms", "expl_ms", "lost", "tmo", "wrong", "slips", "reloc", "rule");
+  for (const Summary* s : rows) {
+    for (const Range& r : ranges) {
+      printf("%10d", s->params.*(r.def->field));
+    }
+    printf("  %7.1f %9.0f %9.0f %5u %5u %5u %6.1f %6.2f %5u\n", 100 * failRate(*s), lapTime(*s), s->exploreMs,
+           s->lost, s->timeouts, s->wrongFinish, s->slips, s->relocations, s->ruleLaps);
+  }
+}
+
+void usage() {
+  fprintf(stderr, "usage: sweep [--laps N] [--threads N] [--seed N] [--left] [--return] [--maze FILE] [--cell MM] [--corner MM] [--grip MM] [--glitch P] [--all] name=lo:hi:step ...\n");
+  fprintf(stderr, "parameters:");
+  for (const ParamDef& d : paramDefs) {
+    fprintf(stderr, " %s", d.name);
+  }
+  fprintf(stderr, "\n");
+}
+
+}
+
+int main(int argc, char** argv) {
+  unsigned laps = 20;
+  unsigned threads = 0;
+  uint32_t seed = 1;
+  double cellMm = 250;
+  double cornerMm = 0;
+  double gripMm = 0;
+  double glitch = 0;
+  bool all = false;
+  SimParams base;
+  std::vector<std::string> mazeRows = defaultMaze;
+  std::vector<Range> ranges;
+
+  for (int i = 1; i < argc; i++) {
+    const char* a = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (strcmp(a, "--laps") == 0 && hasValue) {laps = atoi(argv[++i]);}
+    else if (strcmp(a, "--threads") == 0 && hasValue) {threads = atoi(argv[++i]);}
+    else if (strcmp(a, "--seed") == 0 && hasValue) {seed = strtoul(argv[++i], nullptr, 0);}
+    else if (strcmp(a, "--cell") == 0 && hasValue) {cellMm = atof(argv[++i]);}
+    else if (strcmp(a, "--corner") == 0 && hasValue) {cornerMm = atof(argv[++i]);}
+    else if (strcmp(a, "--grip") == 0 && hasValue) {gripMm = atof(argv[++i]);}
+    else if (strcmp(a, "--glitch") == 0 && hasValue) {glitch = atof(argv[++i]);}
+    else if (strcmp(a, "--left") == 0) {base.rightHand = false;}
+    else if (strcmp(a, "--return") == 0) {base.returnRun = true;}
+    else if (strcmp(a, "--all") == 0) {all = true;}
+    else if (strcmp(a, "--maze") == 0 && hasValue) {
+      mazeRows.clear();
+      if (!loadMazeFile(argv[++i], mazeRows)) {
+        fprintf(stderr, "cannot read maze %s\n", argv[i]);
+        return 1;
+      }
+    }
+    else {
+      Range r;
+      if (!parseRange(a, r)) {
+        usage();
+        return 1;
+      }
+      if (r.lo == r.hi) {
+        base.*(r.def->field) = (int16_t)r.lo;
+      }
+      else {
+        ranges.push_back(r);
+      }
+    }
+  }
+  if (laps == 0) {
+    usage();
+    return 1;
+  }
+
+  std::vector<SimParams> combos = expand(ranges, base);
+  WorkPool pool(threads);
+
+  //one world and controller per worker, nothing shared between them
+  std::vector<SimWorld> worlds(pool.size());
+  std::vector<SimRun> runs;
+  runs.reserve(worlds.size());
+  for (SimWorld& w : worlds) {
+    if (!w.loadMaze(mazeRows, cellMm, cornerMm)) {
+      fprintf(stderr, "maze needs an S start, an F finish and lines\n");
+      return 1;
+    }
+    w.variation.grip = gripMm;
+    w.variation.glitch = glitch;
+  }
+  for (SimWorld& w : worlds) {
+    runs.emplace_back(w);
+  }
+
+  //lap j of every combination uses the same robot, so combinations
+  //are compared on identical hardware variation
+  size_t jobs = combos.size() * laps;
+  std::vector<SimLap> results(jobs);
+  fprintf(stderr, "%zu combinations x %u laps on %u threads\n", combos.size(), laps, pool.size());
+  pool.run(jobs, [&](size_t index, unsigned worker) {
+    const SimParams& params = combos[index / laps];
+    results[index] = runs[worker].run(params, seed + (uint32_t)(index % laps));
+  });
+
+  std::vector<Summary> summaries(combos.size());
+  for (size_t c = 0; c < combos.size(); c++) {
+    Summary& s = summaries[c];
+    s.params = combos[c];
+    unsigned ok = 0;
+    for (unsigned j = 0; j < laps; j++) {
+      const SimLap& lap = results[c * laps + j];
+      s.laps++;
+      s.exploreMs += lap.exploreMs;
+      s.slips += lap.slips;
+      s.relocations += lap.relocations;
+      if (lap.routeLost) {s.ruleLaps++;}
+      if (lap.outcome == SIM_OK) {
+        ok++;
+        s.optMs += lap.optMs;
+        continue;
+      }
+      s.failures++;
+      if (lap.outcome == SIM_LOST) {s.lost++;}
+      else if (lap.outcome == SIM_TIMEOUT) {s.timeouts++;}
+      else {s.wrongFinish++;}
+    }
+    s.exploreMs /= s.laps;
+    s.slips /= s.laps;
+    s.relocations /= s.laps;
+    if (ok) {
+      s.optMs /= ok;
+    }
+  }
+
+  std::vector<const Summary*> rows;
+  for (const Summary& s : summaries) {
+    bool dominated = false;
+    for (const Summary& other : summaries) {
+      if (dominates(other, s)) {
+        dominated = true;
+        break;
+      }
+    }
+    if (all || !dominated) {
+      rows.push_back(&s);
+    }
+  }
+  std::sort(rows.begin(), rows.end(), [](const Summary* a, const Summary* b) {
+    if (failRate(*a) != failRate(*b)) {return failRate(*a) < failRate(*b);}
+    return lapTime(*a) < lapTime(*b);
+  });
+
+  printf("%s\n", all ? "all combinations:" : "pareto front (failure rate vs lap time):");
+  printTable(rows, ranges);
+  return 0;
+}
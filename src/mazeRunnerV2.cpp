@@ -10,8 +10,26 @@
 #include <Wire.h>
 #include <Pololu3piPlus32U4.h>
 #include <string.h>
+#include <FixedPoint.h>
+#include <Odometry.h>
+#include <HeadingFilter.h>
+#include <EventLog.h>
+#include <GainTuner.h>
+#include <MazeDecision.h>
+#include <MazeGraph.h>
+#include <MazeNavigator.h>
+#include <WheelVelocity.h>
+#include <LineControl.h>
+#include <DoubleBuffer.h>
+#include <MemoryStats.h>
+#include <AmbientReject.h>
+#include <Telemetry.h>
+#include <SlipGuard.h>
+#include <EEPROM.h>
 
 using namespace Pololu3piPlus32U4;
+
+#define FIRMWARE_VERSION "1.2.1"
  
 OLED display;
 Buzzer buzzer;
@@ -22,17 +40,118 @@ LineSensors lineSensors;
 BumpSensors bumpSensors;
 Motors motors;
 Encoders encoders;
+IMU imu;
 
 //======================== Global Variables ========================
 //Motor Speed Placeholders
-int motorSpeed = 60;
-int minMotorSpeed = 35;
+int16_t motorSpeed = 60;
+int16_t minMotorSpeed = 35;
+
+//Battery Compensation Variables
+//Motor commands are scaled so the motors see the same effective voltage
+//as on a pack at nominalMv, whatever the actual charge.
+const uint16_t nominalMv = 4800;
+const uint16_t minBatteryMv = 3000; //below this (USB only) no scaling
+const uint8_t batteryPeriod = 100; //ms
+uint16_t batteryMv = nominalMv;
+int32_t batteryScale = 4096; //Q12
+unsigned long batteryTime = 0;
+
+//Velocity Control Variables
+//Motion commands in motor units are turned into wheel speed targets and
+//tracked from encoder feedback by the control interrupt.
+bool velocityControl = true;
+
+//Control Interrupt Variables
+//Timer3 fires at controlHz. Every tick applies the wheel speed targets to
+//the motors; every odomDiv ticks the encoders are read, the pose is
+//integrated and the wheel speed loops are updated. Speed targets reach
+//the wheel loops through SlipGuard's acceleration ramp, and its slip
+//checks run with the odometry. The foreground only exchanges
+//ControlCommand and ControlStatus with it, through double buffers, so
+//the OLED, serial and decision code cannot disturb it.
+const uint16_t controlHz = 1000;
+const uint8_t odomDiv = 10; //ticks, 10 ms
+struct ControlCommand {
+  bool active;          //wheel speed loop owns the motors
+  int16_t targetL;      //mm/s
+  int16_t targetR;      //mm/s
+  int32_t batteryScale; //Q12
+  uint8_t resetSeq;     //bumped to zero the pose
+  uint8_t slipSeq;      //bumped for a slip the gyro saw
+};
+struct ControlStatus {
+  int32_t distance;     //ticks, see Odometry::distance()
+  int16_t x;            //mm
+  int16_t y;            //mm
+  uint16_t heading;     //brad
+  int16_t speedL;       //mm/s, measured
+  int16_t speedR;
+  uint16_t slips;       //slip events since the last pose reset
+  int16_t turnScaleQ8;  //pivot speed share SlipGuard allows
+  uint8_t resetSeq;     //last reset request served
+};
+DoubleBuffer<ControlCommand> controlCommand;
+DoubleBuffer<ControlStatus> controlStatus;
+ControlCommand command = {false, 0, 0, 4096, 0, 0}; //foreground copy
+ControlStatus status = {0, 0, 0, 0, 0, 0, 0, 256, 0}; //foreground snapshot
+volatile uint8_t controlTicks = 0;
+
+//Interrupt-only state
+WheelVelocity wheelL;
+WheelVelocity wheelR;
+SlipGuard slipGuard;
+Odometry odometry;
+bool ctrlActive = false;
+bool ctrlBusy = false;
+uint8_t ctrlPhase = 0;
+uint8_t ctrlResetSeq = 0;
+uint8_t ctrlSlipSeq = 0;
+int16_t ctrlCountsL = 0;
+int16_t ctrlCountsR = 0;
+int16_t ctrlRampL = 0; //mm/s, targets after the acceleration ramp
+int16_t ctrlRampR = 0;
 
 //Encoder Variables
-signed long encCountsL = encoders.getCountsAndResetLeft();
-signed long encCountsR = encoders.getCountsAndResetRight();
 int encCountsAvg = 0;
 
+//Odometry Variables
+IntersectionMap intersections;
+
+//Maze Graph Variables
+//Layout learnt on the way (exits and links of each intersection), for
+//the post-finish search for a shorter route. Directions count quarter
+//turns counter-clockwise from the start heading.
+MazeGraph mazeGraph(intersections);
+uint8_t junctionNode = IntersectionMap::NO_NODE; //node of the last probe
+//Post-finish exploration budgets. A zero budget is not checked; both
+//zero turns the exploration off.
+int16_t postExploreS = 0;
+int16_t postExploreMm = 0;
+
+//Heading Variables (gyro + encoder fusion)
+HeadingFilter headingFilter;
+bool imuOk = false;
+unsigned long headingTime = 0; //us
+int16_t headCountsL = 0;
+int16_t headCountsR = 0;
+const uint16_t gyroCalSamples = 256;
+const int16_t headingHoldKp = 3; //Q8, speed units per brad of drift
+int16_t turnSpeed = 96;
+int16_t turnLeadDeg = 6; //stop early to allow for coasting
+
+//Wheel Slip Limits
+//The first slip SlipGuard sees ramps the wheel speed targets at accMax,
+//each further one lowers that towards accMin; every one slows the
+//pivots. Both hold for the rest of the run. slipAcc is the measured
+//wheel acceleration taken as slip, slipDeg the encoder turn the gyro
+//did not see. Handed to the control interrupt at each pose reset. A
+//zero accMax never ramps, a zero slipDeg turns the gyro check off.
+int16_t accMax = 10000;  //mm/s^2
+int16_t accMin = 2000;   //mm/s^2
+int16_t slipAcc = 20000; //mm/s^2
+int16_t slipDeg = 8;
+
 //Bump Sensor Variables
 bool bumpLeft = false;
 bool bumpRight = false;
@@ -40,15 +159,36 @@ bool bumpRight = false;
 //Line Sensor Variables
 uint16_t lineSensVals[5];
 uint16_t lineSensCalib[5];
-uint16_t predict = 0;
-uint16_t sensVals[4];
+
+//Ambient Light Rejection
+//Each frame's emitters-on read is paired with an emitters-off read taken
+//just before it, in the line loop's idle time, and the room light seen
+//by the off read is subtracted. ambientUs is the off read's timeout;
+//0 reads with the emitters on only.
+AmbientReject ambient;
+int16_t ambientUs = 600;
+bool ambientFresh = false; //off read taken for the next frame
+
+//Sensor Frame: one calibrated read per control iteration, shared by
+//the line follower, the intersection checks and the decision logic.
+struct SensorFrame {
+  uint16_t vals[5]; //calibrated, oriented so the line always reads 1000
+  uint16_t predict; //weighted line position, 0 (left) to 4000 (right)
+  bool left;
+  bool center;
+  bool right;
+  bool onLine; //any sensor sees the line
+  unsigned long sampleUs; //micros() halfway through the read
+};
+SensorFrame frame = {{0, 0, 0, 0, 0}, 2000, false, false, false, false, 0};
 
 //Maze Runner Decision Memory Variables
 const int MAX_DECISIONS = 100; // Maximum size of the decision history
 char decisionHistory[MAX_DECISIONS]; // Stores decisions made during the first run
 char optimizedPath[MAX_DECISIONS]; // optimized path
 int decisionCount = -1; // Initialize at -1 because we increment before storing
-int optCount = -1;
+//Position on the maze graph and the route driven over it
+MazeNavigator navigator(intersections, mazeGraph, optimizedPath, decisionCount);
 char decision;
 char forcedDecision = ' ';
 char decisionMem = ' ';
@@ -57,25 +197,45 @@ char intersection = 0;
 int printCount = 0;
 bool isForcedDecision = false; // Identificate forced decitions
 
+//Flight Recorder Variables
+EventLog flightLog;
+unsigned long runStartTime = 0;
+int32_t runStartDist = 0;
+uint16_t logSlips = 0; //status.slips at the last event
+
+//Benchmark Variables
+//Time totals per run, 0 = exploration, 1 = optimized run
+struct RunStats {
+  unsigned long totalMs;
+  unsigned long straightMs;
+  unsigned long probeMs;
+  unsigned long ruleMs;
+  unsigned long turnMs;
+  unsigned long delayMs; //stationary fixed delays, part of the phases above
+  unsigned long oledUs;  //display buffer work in the control loop
+  uint16_t intersections;
+  uint16_t decisions;
+  uint16_t slips;        //SlipGuard events
+  uint16_t relocations;  //optimized run: route picked up off its next node
+  bool routeLost;        //optimized run: fell back to the search rule
+};
+RunStats runStats[2];
+uint8_t statsRun = 0;
+bool benchmark = false;
+
 
 
-//Time Variables
-float prevTime = 0;
-float period = 0.05;
+//Line Loop Timing
+//The line follower steps once per linePeriod control ticks, so its PID
+//runs at a fixed rate however long the OLED and sensor reads take.
+int16_t linePeriod = 3; //ms
+uint8_t lineTick = 0;
 
 //Maze Runner Mode Variables
 bool whiteLine = false;
 bool rightHand = true;
 
-// Left, Center, Right Line Sensor Isolations
-int leftInt;
-int centerInt;
-int rightInt;
-
-bool left;
-bool center;
-bool right;
-
+// Left, Center, Right Line Sensor Memory
 bool leftMem;
 int centerLMem;
 bool centerMem;
@@ -86,12 +246,168 @@ bool rightMem;
 int motorSpeedAdj;
 int motorSpeedL = 0;
 int motorSpeedR = 0;
-uint16_t Kp = 64; //0.5 //10:68s, 8:86s
-uint16_t Kd = 256; //3.0 //10:68s, 8:86s
+int16_t Kp = 64; //0.5 //10:68s, 8:86s
+int16_t Kd = 256; //3.0 //10:68s, 8:86s
 const int midPoint = 2000;
 int deviation = 0;
-int lastDeviation = 0;
 long integral = 0;
+int16_t minSpeedRatio = fx::Q8(0.7); //lower wheel clamp, fraction of motorSpeed
+
+//Curvature Control Variables
+//Bends are estimated from the line position history and the encoder
+//differential. The estimate steers both wheels into the bend and caps
+//the speed so motorSpeed only applies on straights.
+bool curveControl = true;
+int16_t latAcc = 3000; //mm/s^2, bend speed limit; minMotorSpeed is the floor
+int16_t ffGain = 256; //Q8, feed-forward share of the modelled wheel offset
+//Line state estimator: the PID works on the line offset predicted to
+//when its command reaches the wheels, and on the tracked offset rate
+//instead of the difference of two raw reads. A zero alpha uses the raw
+//reads as before.
+int16_t estAlpha = 160; //Q8
+int16_t estBeta = 32;   //Q8
+int16_t leadUs = 1500;  //command to wheels: next control tick plus motor lag
+//Steering, estimator and curvature state of the current segment
+LineControl lineControl;
+
+//Detection Thresholds (calibrated sensor units, line = 1000)
+int16_t lineThreshold = 700; //sensor sees the line
+int16_t gapThreshold = 600; //inner sensors below this end a segment
+
+//Line Loss Recovery
+//A line lost while it sat at least recoverDev off center slid out from
+//under the sensors (a bend taken too fast, a blemish) rather than ended:
+//keep steering after it for lossMm, then pivot towards it by up to
+//recoverDeg before the probe gets to call it a dead end. A zero
+//recoverDev turns recovery off, a zero lossMm or recoverDeg skips that stage.
+int16_t recoverDev = 1000; //position units, one sensor pitch
+int16_t lossMm = 20;
+int16_t recoverDeg = 30;
+
+//Crawl Timings
+int16_t crawlSpeed = 61; //probe crawl after a detection
+int16_t crawlMs = 38;
+int16_t alignSpeed = 40; //crawl to put the wheels on the intersection
+int16_t alignMs = 140;
+
+//Tuning Console Variables
+//Parameters that can be read and written over USB serial at runtime
+struct TuneParam {
+  const char* name; //PROGMEM
+  int16_t* value;
+  int16_t min;
+  int16_t max;
+};
+const char pnSpeed[] PROGMEM = "speed";
+const char pnMinSpeed[] PROGMEM = "minspeed";
+const char pnKp[] PROGMEM = "kp";
+const char pnKd[] PROGMEM = "kd";
+const char pnClamp[] PROGMEM = "clampq8";
+const char pnLine[] PROGMEM = "linethr";
+const char pnGap[] PROGMEM = "gapthr";
+const char pnCrawlSpeed[] PROGMEM = "crawlspd";
+const char pnCrawlMs[] PROGMEM = "crawlms";
+const char pnAlignSpeed[] PROGMEM = "alignspd";
+const char pnAlignMs[] PROGMEM = "alignms";
+const char pnTurnSpeed[] PROGMEM = "turnspd";
+const char pnTurnLead[] PROGMEM = "turnlead";
+const char pnLatAcc[] PROGMEM = "latacc";
+const char pnFfGain[] PROGMEM = "ffgainq8";
+const char pnLinePeriod[] PROGMEM = "lineperms";
+const char pnAmbient[] PROGMEM = "ambientus";
+const char pnPostS[] PROGMEM = "postexps";
+const char pnPostMm[] PROGMEM = "postexpmm";
+const char pnEstAlpha[] PROGMEM = "estaq8";
+const char pnEstBeta[] PROGMEM = "estbq8";
+const char pnLead[] PROGMEM = "leadus";
+const char pnRecoverDev[] PROGMEM = "recdev";
+const char pnLossMm[] PROGMEM = "lossmm";
+const char pnRecoverDeg[] PROGMEM = "recdeg";
+const char pnAccMax[] PROGMEM = "accmax";
+const char pnAccMin[] PROGMEM = "accmin";
+const char pnSlipAcc[] PROGMEM = "slipacc";
+const char pnSlipDeg[] PROGMEM = "slipdeg";
+const TuneParam tuneParams[] PROGMEM = {
+  {pnSpeed, &motorSpeed, 0, 400},
+  {pnMinSpeed, &minMotorSpeed, 0, 400},
+  {pnKp, &Kp, 0, 4096},
+  {pnKd, &Kd, 0, 8192},
+  {pnClamp, &minSpeedRatio, 0, 256},
+  {pnLine, &lineThreshold, 0, 1000},
+  {pnGap, &gapThreshold, 0, 1000},
+  {pnCrawlSpeed, &crawlSpeed, 0, 400},
+  {pnCrawlMs, &crawlMs, 0, 1000},
+  {pnAlignSpeed, &alignSpeed, 0, 400},
+  {pnAlignMs, &alignMs, 0, 1000},
+  {pnTurnSpeed, &turnSpeed, 0, 400},
+  {pnTurnLead, &turnLeadDeg, 0, 45},
+  {pnLatAcc, &latAcc, 500, 16000},
+  {pnFfGain, &ffGain, 0, 512},
+  {pnLinePeriod, &linePeriod, 1, 20},
+  {pnAmbient, &ambientUs, 0, 900},
+  {pnPostS, &postExploreS, 0, 600},
+  {pnPostMm, &postExploreMm, 0, 30000},
+  {pnEstAlpha, &estAlpha, 0, 255},
+  {pnEstBeta, &estBeta, 0, 255},
+  {pnLead, &leadUs, 0, 10000},
+  {pnRecoverDev, &recoverDev, 0, 2000},
+  {pnLossMm, &lossMm, 0, 100},
+  {pnRecoverDeg, &recoverDeg, 0, 90},
+  {pnAccMax, &accMax, 0, 30000},
+  {pnAccMin, &accMin, 0, 30000},
+  {pnSlipAcc, &slipAcc, 1000, 30000},
+  {pnSlipDeg, &slipDeg, 0, 45},
+};
+const uint8_t tuneParamCount = sizeof(tuneParams) / sizeof(tuneParams[0]);
+const uint8_t paramsMagic = 0x5A;
+const int eepromParams = 64; //EEPROM address, after the tuned gains
+char consoleLine[32];
+uint8_t consoleLen = 0;
+
+//Telemetry: one binary frame per line control step for the host
+//capture tool (capture/), while turned on from the console
+bool telemetryOn = false;
+uint8_t telemetrySeq = 0;
+
+//Autotune Variables
+//Best gains per speed, found by autotune() and kept in EEPROM
+struct TunedGains {
+  uint8_t magic;
+  uint8_t count;
+  GainSet sets[GainTuner::MAX_SPEEDS];
+};
+const uint8_t tunedGainsMagic = 0xA5;
+const int eepromTunedGains = 0; //EEPROM address
+const uint16_t trialMm = 1500; //measured distance per trial
+const uint16_t settleMm = 150; //run-in before measuring
+const uint16_t lineLostMs = 150; //line loss longer than this fails a trial
+const int16_t tuneSpeedStep = 20;
+
+//Quick Start Profile
+//A timed run stored whole: line type, rule, speed, gains and, if
+//flagged, the sensor calibration and the solved route, so one press at
+//boot drives off without menus, countdowns or the calibration spin.
+//The route's turns follow the record in EEPROM.
+const uint8_t PROFILE_WHITE_LINE = 0x01;
+const uint8_t PROFILE_RIGHT_HAND = 0x02;
+const uint8_t PROFILE_CALIBRATION = 0x04; //no calibration spin
+const uint8_t PROFILE_ROUTE = 0x08;       //timed run, no exploration
+struct RunProfile {
+  uint8_t magic;
+  uint8_t flags;
+  int16_t speed;
+  int16_t kp;
+  int16_t kd;
+  uint16_t lineMin[5];    //lineSensors calibration
+  uint16_t lineMax[5];
+  uint16_t ambientMin[5]; //ambient-free calibration
+  uint16_t ambientMax[5];
+  int8_t routeCount;      //last route index, -1 for none
+};
+const uint8_t profileMagic = 0xC3;
+const int eepromProfile = 128; //EEPROM address, after the parameters
+const int eepromProfileRoute = eepromProfile + sizeof(RunProfile);
+static_assert(eepromParams + 2 + 2 * tuneParamCount <= eepromProfile, "parameters overlap the quick run profile");
 
 //Angle Variables
 int angleTotal = 0;
@@ -100,33 +416,91 @@ int angleTotal = 0;
 //Menu display declarations
 char mainMenu(char);
 char opMenu(char);
+char quickMenu(char);
 int settings(int);
 
 //Settings function declarations
 void speed();
 void lineSensorsSet(int);
+void autotune();
+bool applyTunedGains();
 
 //Operation modes declarations
 void mazeRunner();
+uint8_t exploreMaze();
+void routeMenu(uint8_t routeItem);
+void quickRun();
+void viewFlightLog();
+void showBenchmark();
+void printBenchmark();
 
 //About function declaration
 void about();
+void printMemory();
 
 //Conversion functions
-float tick2deg(int);
+int32_t tick2deg(int32_t);
+
+//Motor output functions
+void setMotorSpeeds(int16_t left, int16_t right);
+void sampleBattery(bool reset);
+void driveWheels(int16_t left, int16_t right);
+void startControlTimer();
+void controlTick();
+int16_t scaleToBattery(int16_t speed, int32_t scale);
 
 //utility functions
 void optimizePath(char[], int&);
+Junction junctionMem();
 char rightHandDecision();
 char leftHandDecision();
 void updateSensors();
+void readAmbient();
+void readLineSensors(uint16_t*);
+void calibrateSensors();
+void resetOdometry();
+void updateOdometry();
+void serviceMotion();
+void printRouteGeometry();
+void calibrateGyro();
+void syncHeading();
+void updateHeading();
+void crawlStraight(int16_t speed, uint16_t ms);
+int16_t pivotSpeed();
+void turnBy(int16_t deg);
+void startFlightLog(bool clear);
+void logIntersection(char decision, uint8_t flags, unsigned long straightStart, unsigned long probeStart, unsigned long ruleStart, unsigned long turnStart);
+void dumpFlightLog();
+void serviceConsole();
+void runConsoleCommand(char* line);
+void sendTelemetry();
+void saveParams();
+bool loadParams();
+bool saveProfile(bool withRoute);
+bool readProfile(RunProfile& profile);
+void applyProfile(const RunProfile& profile);
+void clearProfile();
+void pause(uint16_t ms);
 void verifyIntersection_crawlFwd(int ticks, bool leftRef, bool centerRef, bool rightRef);
 void crawlFwd_alignToWheel();
+void storeDecision(char decision);
+void handleDecision(char decision, DecisionKind kind);
+void runRoute(bool back);
+void probeIntersection();
+NavPose navPose();
+uint8_t driveLink(uint8_t expected);
+bool driveTo(uint8_t target);
+bool postExplore();
 
 //Maze Solver Dedicated Functions
 void straightSegment();
-char leftHandRule();
-char rightHandRule();
+bool recoverLine();
+bool lineReacquired();
+void lineControlStep();
+void resetLineControl();
+LineGains lineGains();
+void calibrateLineSensors();
+JunctionAction searchRule();
 void turnControl();
 //================= Special Character Definitions ==================
 //Forward arrows
@@ -218,10 +592,24 @@ void setup() {
 
   bumpSensors.calibrate();
   Serial.begin(9600);
+  loadParams();
+  sampleBattery(true);
+
+  //IMU for heading, falls back to encoders only if missing
+  Wire.begin();
+  imuOk = imu.init();
+  if (imuOk) {
+    imu.configureForTurnSensing();
+    calibrateGyro();
+  }
+  else {
+    headingFilter.encoderWeight = 255;
+  }
+  startControlTimer();
 }
 
 void loop() {
-  char mode = 0;
+  char mode = 4; //quick start screen first, if a profile is stored
   //int vel = motorSpeed;
   while (true) {
     //update settings variables
@@ -244,11 +632,32 @@ void loop() {
       about();
       mode = 0;
       break;
+    case 4:
+      //Quick start
+      mode = quickMenu(mode);
+      break;
     case 11:
       //Line Follow mode
       mazeRunner();
       mode = 1;
       break;
+    case 12:
+      //Benchmark: maze runner with a timing report
+      benchmark = true;
+      mazeRunner();
+      benchmark = false;
+      mode = 1;
+      break;
+    case 13:
+      //Flight Log viewer
+      viewFlightLog();
+      mode = 1;
+      break;
+    case 14:
+      //Quick run from the stored profile
+      quickRun();
+      mode = 1;
+      break;
     case 21:
       //Motor Speed
       speed();
@@ -259,6 +668,11 @@ void loop() {
       lineSensorsSet(mode);
       mode = 2;
       break;
+    case 23:
+      //PID Autotune
+      autotune();
+      mode = 2;
+      break;
 
     default:
       break;
@@ -273,16 +687,17 @@ char mainMenu(char mode) {
   display.clear();
   display.setLayout21x8();
   display.gotoXY(0,0);
-  display.print("3pi+ Test Platform   ");
+  display.print(F("3pi+ Test Platform   "));
   display.gotoXY(0,5);
-  display.print("Start              :A");
+  display.print(F("Start              :A"));
   display.gotoXY(0,6);
-  display.print("Settings           :B");
+  display.print(F("Settings           :B"));
   display.gotoXY(0,7);
-  display.print("About              :C");
+  display.print(F("About              :C"));
   display.display();
 
   while(true) {
+    serviceConsole();
     if(buttonA.getSingleDebouncedPress()) {
       mode = 1;
       break;
@@ -305,29 +720,30 @@ char opMenu(char mode) {
   display.noInvert();
   display.setLayout21x8();
   display.gotoXY(0,0);
-  display.print("Operation Modes:     ");
+  display.print(F("Operation Modes:     "));
   display.gotoXY(0,2);
-  display.print("                   >>");
+  display.print(F("                   >>"));
   display.gotoXY(0,5);
-  display.print("Next               :A");
+  display.print(F("Next               :A"));
   display.gotoXY(0,6);
-  display.print("Select             :B");
+  display.print(F("Select             :B"));
   display.gotoXY(0,7);
-  display.print("Back\7              :C");
+  display.print(F("Back\7              :C"));
   //display.display();
 
   int setting = 0;
-  const char* settings[] = {"Maze Runner"};
+  static const char settings[][12] PROGMEM = {"Maze Runner", "Benchmark  ", "Flight Log "};
   while(true) {
+    serviceConsole();
     //display.gotoXY(0,2);
     //display.print("                   ");
     display.gotoXY(0,2);
     //display.print();
-    display.print(settings[setting]);
+    display.print((const __FlashStringHelper*)settings[setting]);
     display.display();
     if (buttonA.getSingleDebouncedPress()){
       setting++;
-      if (setting == 1) setting = 0;
+      if (setting == 3) setting = 0;
     }
     else if (buttonB.getSingleDebouncedPress()){
       mode = setting + 11;
@@ -341,31 +757,81 @@ char opMenu(char mode) {
   return mode;
 }
 
+//Boot screen while a quick run profile is stored: B starts it at once,
+//A or C goes on to the main menu. Skipped without a profile.
+char quickMenu(char mode) {
+  RunProfile profile;
+  if (!readProfile(profile)) {
+    return 0;
+  }
+  display.clear();
+  display.noInvert();
+  display.setLayout21x8();
+  display.gotoXY(0,0);
+  display.print(F("Quick Run:           "));
+  display.gotoXY(0,1);
+  display.print(profile.flags & PROFILE_WHITE_LINE ? F("White Line ") : F("Black Line "));
+  display.print(profile.flags & PROFILE_RIGHT_HAND ? F("Right Hand") : F("Left Hand"));
+  display.gotoXY(0,2);
+  display.print(F("Speed: "));
+  display.print(profile.speed);
+  display.gotoXY(0,3);
+  display.print(profile.flags & PROFILE_CALIBRATION ? F("Stored calibration") : F("Calibration spin"));
+  display.gotoXY(0,4);
+  if (profile.flags & PROFILE_ROUTE) {
+    display.print(F("Route: "));
+    display.print(profile.routeCount + 1);
+    display.print(F(" turns"));
+  }
+  else {
+    display.print(F("Explore first"));
+  }
+  display.gotoXY(0,6);
+  display.print(F("Run               :B"));
+  display.gotoXY(0,7);
+  display.print(F("Menu            :A/C"));
+  display.display();
+
+  while(true) {
+    serviceConsole();
+    if(buttonB.getSingleDebouncedPress()) {
+      mode = 14;
+      break;
+    }
+    else if(buttonA.getSingleDebouncedPress() || buttonC.getSingleDebouncedPress()) {
+      mode = 0;
+      break;
+    }
+  }
+  return mode;
+}
+
 int settings(int mode) {
   display.clear();
   display.setLayout21x8();
   display.gotoXY(0,0);
-  display.print("Settings:            ");
+  display.print(F("Settings:            "));
   display.gotoXY(0,2);
-  display.print("                   >>");
+  display.print(F("                   >>"));
   display.gotoXY(0,5);
-  display.print("Next               :A");
+  display.print(F("Next               :A"));
   display.gotoXY(0,6);
-  display.print("Select             :B");
+  display.print(F("Select             :B"));
   display.gotoXY(0,7);
-  display.print("Back\7              :C");
+  display.print(F("Back\7              :C"));
   display.display();
 
   int setting = 0;
-  String settings[] = {"Motor Speed ", "Line Sensors"};
+  static const char settings[][13] PROGMEM = {"Motor Speed ", "Line Sensors", "Autotune    "};
   while(true) {
+    serviceConsole();
     display.gotoXY(0,2);
-    display.print(settings[setting]);
+    display.print((const __FlashStringHelper*)settings[setting]);
     display.gotoXY(0,2);
     display.displayPartial(2, 0, 23);
     if (buttonA.getSingleDebouncedPress()){
       setting++;
-      if (setting == 2) setting = 0;
+      if (setting == 3) setting = 0;
     }
     else if (buttonB.getSingleDebouncedPress()){
       mode = setting + 21;
@@ -382,15 +848,34 @@ int settings(int mode) {
 void about() {
   display.clear();
   display.gotoXY(0,0);
-  display.print("3pi+ Pest Platform   ");
+  display.print(F("3pi+ Pest Platform   "));
   display.gotoXY(0,1);
-  display.print("Version: 1.2.1       ");
+  display.print(F("Version: " FIRMWARE_VERSION "       "));
   display.gotoXY(0,2);
-  display.print("All in one functiona-");
+  display.print(F("All in one functiona-"));
   display.gotoXY(0,3);
-  display.print("lity test platform.  ");
+  display.print(F("lity test platform.  "));
+
+  //SRAM budget
+  MemoryReport m = mem::report();
+  display.gotoXY(0,4);
+  display.print(F("Static "));
+  display.print(m.data + m.bss);
+  display.print(F("/"));
+  display.print(m.total);
+  display.print(F(" B"));
+  display.gotoXY(0,5);
+  display.print(F("Heap "));
+  display.print(m.heap);
+  display.print(F(" peak "));
+  display.print(m.heapPeak);
+  display.gotoXY(0,6);
+  display.print(F("Stack "));
+  display.print(m.stackPeak);
+  display.print(F(" free "));
+  display.print(m.freeMin);
   display.gotoXY(0,7);
-  display.print("Back\7              :C");
+  display.print(F("Back\7              :C"));
   display.display();
 
   while(true){
@@ -407,11 +892,11 @@ void speed(){
   display.clear();
   display.setLayout21x8();
   display.gotoXY(0,0);
-  display.print("Motor Speed:         ");
+  display.print(F("Motor Speed:         "));
   display.gotoXY(0,6);
-  display.print(" A        B        C ");
+  display.print(F(" A        B        C "));
   display.gotoXY(0,7);
-  display.print(" -        +        \7 ");
+  display.print(F(" -        +        \7 "));
   display.display();
   while(true){
     //vel edit
@@ -425,29 +910,29 @@ void speed(){
     }
     //print vel value
     display.gotoXY(0,2);
-    display.print("Min");
+    display.print(F("Min"));
     display.gotoXY(18,2);
-    display.print("Max");
+    display.print(F("Max"));
     display.gotoXY(0,3);
-    display.print(" 0 ");
+    display.print(F(" 0 "));
     display.gotoXY(18,3);
-    display.print("400");
+    display.print(F("400"));
     display.display();
     display.gotoXY(9,3);
     display.print(vel);
-    display.print(" ");
+    display.print(F(" "));
     display.gotoXY(0,2);
     display.displayPartial(2, 0, 23);
     
-    motors.setSpeeds(vel, vel);
+    setMotorSpeeds(vel, vel);
     //option exit
     if (buttonC.getSingleDebouncedPress()){
-      motors.setSpeeds(0, 0);
+      setMotorSpeeds(0, 0);
       motorSpeed = vel;
       break;
     }
   }
-  motors.setSpeeds(0, 0);
+  setMotorSpeeds(0, 0);
 }
 
 void lineSensorsSet(int sens) {
@@ -458,61 +943,61 @@ void lineSensorsSet(int sens) {
   display.clear();
   display.setLayout21x8();
   display.gotoXY(0,0);
-  display.print("Line Sens:");
+  display.print(F("Line Sens:"));
   //display.gotoXY(0,1);
-  display.print(" Emitters:         ");
+  display.print(F(" Emitters:         "));
   display.gotoXY(0,2);
-  display.print("    2    3    4      ");
+  display.print(F("    2    3    4      "));
   display.gotoXY(0,3);
-  display.print("1                   5");
+  display.print(F("1                   5"));
   display.gotoXY(0,5);
-  display.print("Calibrate          :A");
+  display.print(F("Calibrate          :A"));
   display.gotoXY(0,6);
-  display.print("Toggle Emitters    :B");
+  display.print(F("Toggle Emitters    :B"));
   display.gotoXY(0,7);
-  display.print("Back\7              :C");
+  display.print(F("Back\7              :C"));
 
   while(true) {
     display.gotoXY(0,0);
-    display.print("Line Sens:           ");
-    lineSensors.readCalibrated(lineSensVals);
+    display.print(F("Line Sens:           "));
+    readLineSensors(lineSensVals);
 
     display.gotoXY(10,0);
     //display.print(" Calibrated");
     display.gotoXY(0,4);
     display.print(lineSensVals[0]);
-    display.print("    ");
+    display.print(F("    "));
     display.gotoXY(4,3);
     display.print(lineSensVals[1]);
-    display.print("    ");
+    display.print(F("    "));
     display.gotoXY(9,3);
     display.print(lineSensVals[2]);
-    display.print("    ");
+    display.print(F("    "));
     display.gotoXY(14,3);
     display.print(lineSensVals[3]);
-    display.print("    ");
+    display.print(F("    "));
     display.gotoXY(17,4);
     display.print(lineSensVals[4]);
-    display.print("    ");
+    display.print(F("    "));
     display.display();
 
 
     if(emitterToggle) {
       lineSensors.emittersOn();
       display.gotoXY(13,1);
-      display.print("On ");
+      display.print(F("On "));
     } 
     else if(!emitterToggle) {
       lineSensors.emittersOff();
       display.gotoXY(13,1);
-      display.print("Off");
+      display.print(F("Off"));
     }
     if (buttonA.getSingleDebouncedPress()) {
       for (int i = 0; i<100; i++){
-        lineSensors.calibrate();
+        calibrateSensors();
         delay(100);
         display.gotoXY(0,0);
-        display.print("Calibrating...");
+        display.print(F("Calibrating..."));
       }
     }
     else if(buttonB.getSingleDebouncedPress()) {
@@ -526,6 +1011,201 @@ void lineSensorsSet(int sens) {
   }
 }
 
+//Runs the line follower on a closed test loop, searching Kp/Kd for the
+//lowest tracking error and lap time, stepping motorSpeed up each time
+//the search converges. Best gains per speed are saved to EEPROM.
+void autotune() {
+  GainTuner tuner;
+  TunedGains table;
+  int16_t savedSpeed = motorSpeed;
+  uint16_t savedKp = Kp;
+  uint16_t savedKd = Kd;
+  bool abort = false;
+
+  display.clear();
+  display.gotoXY(0,0);
+  display.print(F("Autotune:            "));
+  display.gotoXY(0,2);
+  display.print(F("Place robot on a    "));
+  display.gotoXY(0,3);
+  display.print(F("closed test loop.   "));
+  display.gotoXY(0,6);
+  display.print(F("Start    :B "));
+  display.gotoXY(0,7);
+  display.print(F("Back\7    :C "));
+  display.display();
+  while(true) {
+    if(buttonB.getSingleDebouncedPress()) {
+      break;
+    }
+    if(buttonC.getSingleDebouncedPress()) {
+      return;
+    }
+  }
+
+  display.clear();
+  calibrateLineSensors();
+  tuner.start(motorSpeed, Kp, Kd, tuneSpeedStep, 400);
+
+  while(!tuner.done() && !abort) {
+    TrialResult result;
+    uint32_t sumSq = 0; //of deviation / 4, which keeps a trial well inside 32 bits
+    uint16_t samples = 0;
+    unsigned long lostSince = 0;
+
+    motorSpeed = tuner.speed();
+    Kp = tuner.kp();
+    Kd = tuner.kd();
+    result.stable = true;
+
+    display.clear();
+    display.gotoXY(0,0);
+    display.print(F("Autotune  Abort :C"));
+    display.gotoXY(0,1);
+    display.print(F("Spd "));
+    display.print(motorSpeed);
+    display.print(F(" Kp "));
+    display.print(Kp);
+    display.print(F(" Kd "));
+    display.print(Kd);
+    display.display();
+
+    resetOdometry();
+    int32_t settleTicks = fx::mmToTicks(settleMm);
+    int32_t endTicks = settleTicks + fx::mmToTicks(trialMm);
+    unsigned long trialStart = 0;
+    resetLineControl();
+
+    while(status.distance < endTicks) {
+      lineControlStep();
+
+      if (!frame.onLine) {
+        if (lostSince == 0) {lostSince = millis();}
+        if (millis() - lostSince > lineLostMs) {
+          result.stable = false;
+          break;
+        }
+      }
+      else {
+        lostSince = 0;
+      }
+
+      if (status.distance >= settleTicks) {
+        if (trialStart == 0) {trialStart = millis();}
+        int16_t quarter = constrain(deviation, -midPoint, midPoint) / 4;
+        if (sumSq < 0xFFFFFFFFUL - (uint32_t)midPoint * midPoint / 16) {
+          sumSq += (int32_t)quarter * quarter;
+          samples++;
+        }
+      }
+      if (buttonC.getSingleDebouncedPress()) {
+        abort = true;
+        break;
+      }
+    }
+    if (abort) {
+      break;
+    }
+
+    result.timeMs = millis() - trialStart;
+    result.rms = 0;
+    if (samples > 0) {
+      result.rms = fx::isqrt32(sumSq / samples) * 4;
+    }
+    tuner.report(result);
+
+    display.gotoXY(0,2);
+    display.print(F("RMS "));
+    display.print(result.rms);
+    display.print(F(" T "));
+    display.print(result.timeMs);
+    display.print(F("ms"));
+    display.gotoXY(0,3);
+    display.print(F("Found "));
+    display.print(tuner.resultCount());
+    display.print(F(" speeds"));
+    display.display();
+
+    if (!result.stable) {
+      //robot left the loop, put it back before the next trial
+      driveWheels(0, 0);
+      display.gotoXY(0,5);
+      display.print(F("Line lost."));
+      display.gotoXY(0,6);
+      display.print(F("Re-place, B: go"));
+      display.display();
+      while(true) {
+        if(buttonB.getSingleDebouncedPress()) {
+          break;
+        }
+        if(buttonC.getSingleDebouncedPress()) {
+          abort = true;
+          break;
+        }
+      }
+    }
+  }
+  driveWheels(0, 0);
+
+  motorSpeed = savedSpeed;
+  Kp = savedKp;
+  Kd = savedKd;
+
+  //save and show what was found
+  table.magic = tunedGainsMagic;
+  table.count = tuner.resultCount();
+  for (uint8_t i = 0; i < table.count; i++) {
+    table.sets[i] = tuner.result(i);
+  }
+  if (table.count > 0) {
+    EEPROM.put(eepromTunedGains, table);
+  }
+
+  display.clear();
+  display.gotoXY(0,0);
+  display.print(F("Tuned gains: "));
+  display.print(table.count);
+  for (uint8_t i = 0; i < table.count && i < 6; i++) {
+    display.gotoXY(0, i + 1);
+    display.print(table.sets[i].speed);
+    display.print(F(": "));
+    display.print(table.sets[i].kp);
+    display.print(F(" / "));
+    display.print(table.sets[i].kd);
+  }
+  display.gotoXY(0,7);
+  display.print(F("Back\7              :C"));
+  display.display();
+  while(true) {
+    if(buttonC.getSingleDebouncedPress()) {
+      break;
+    }
+  }
+}
+
+//Loads the tuned gains for the fastest stored speed not above motorSpeed.
+//Returns false and keeps the current gains if nothing applies.
+bool applyTunedGains() {
+  TunedGains table;
+  EEPROM.get(eepromTunedGains, table);
+  if (table.magic != tunedGainsMagic || table.count > GainTuner::MAX_SPEEDS) {
+    return false;
+  }
+
+  int8_t best = -1;
+  for (uint8_t i = 0; i < table.count; i++) {
+    if (table.sets[i].speed <= motorSpeed) {
+      best = i;
+    }
+  }
+  if (best < 0) {
+    return false;
+  }
+  Kp = table.sets[best].kp;
+  Kd = table.sets[best].kd;
+  return true;
+}
+
 //==================== Maze Runner ================================
 
 void mazeRunner() {
@@ -536,20 +1216,20 @@ void mazeRunner() {
   display.noInvert();
   display.setLayout21x8();
   display.gotoXY(0,0);
-  display.print("Maze Runner:         ");
-  lineSensors.readCalibrated(lineSensVals);
+  display.print(F("Maze Runner:         "));
+  readLineSensors(lineSensVals);
 
   //Line type setting screen
   display.gotoXY(0,1);
-  display.print("  Select Line Type:  ");
+  display.print(F("  Select Line Type:  "));
   display.gotoXY(0,3);
-  display.print("     Black Line      ");
+  display.print(F("     Black Line      "));
   display.gotoXY(0,4);
-  display.print("     White Line      ");
+  display.print(F("     White Line      "));
   display.gotoXY(0,6);
-  display.print(" A        B          ");
+  display.print(F(" A        B          "));
   display.gotoXY(0,7);
-  display.print("\1/\2      SEL       ");
+  display.print(F("\1/\2      SEL       "));
 
   //line type setting loop
   while(modeLoc == 1) {
@@ -558,24 +1238,24 @@ void mazeRunner() {
       if (whiteLine) {
         //select white on screen
         display.gotoXY(3,4);
-        display.print("->");
-        display.print("White Line");
-        display.print("<-");
+        display.print(F("->"));
+        display.print(F("White Line"));
+        display.print(F("<-"));
         //deselect black on screen
         display.gotoXY(3,3);
-        display.print("  ");
-        display.print("Black Line");
-        display.print("  ");
+        display.print(F("  "));
+        display.print(F("Black Line"));
+        display.print(F("  "));
       }
       else {
         display.gotoXY(3,3);
-        display.print("->");
-        display.print("Black Line");
-        display.print("<-");
+        display.print(F("->"));
+        display.print(F("Black Line"));
+        display.print(F("<-"));
         display.gotoXY(3,4);
-        display.print("  ");
-        display.print("White Line");
-        display.print("  ");
+        display.print(F("  "));
+        display.print(F("White Line"));
+        display.print(F("  "));
       }
     }
     else if(buttonB.getSingleDebouncedPress()) {
@@ -591,15 +1271,15 @@ void mazeRunner() {
   //search rule setting
   display.clear();
   display.gotoXY(0,1);
-  display.print(" Select Search Rule: ");
+  display.print(F(" Select Search Rule: "));
   display.gotoXY(0,3);
-  display.print("     Right Hand      ");
+  display.print(F("     Right Hand      "));
   display.gotoXY(0,4);
-  display.print("     Left Hand       ");
+  display.print(F("     Left Hand       "));
   display.gotoXY(0,6);
-  display.print(" A        B          ");
+  display.print(F(" A        B          "));
   display.gotoXY(0,7);
-  display.print("\1/\2      SEL       ");
+  display.print(F("\1/\2      SEL       "));
 
   //search rule setting loop
   while(modeLoc == 2) {
@@ -608,24 +1288,24 @@ void mazeRunner() {
       if (rightHand) {
         //select right on screen
         display.gotoXY(3,3);
-        display.print("->");
-        display.print("Right Hand");
-        display.print("<-");
+        display.print(F("->"));
+        display.print(F("Right Hand"));
+        display.print(F("<-"));
         //deselect left on screen
         display.gotoXY(3,4);
-        display.print("  ");
-        display.print("Left Hand");
-        display.print("  ");
+        display.print(F("  "));
+        display.print(F("Left Hand"));
+        display.print(F("  "));
       }
       else {
         display.gotoXY(3,3);
-        display.print("  ");
-        display.print("Right Hand");
-        display.print("  ");
+        display.print(F("  "));
+        display.print(F("Right Hand"));
+        display.print(F("  "));
         display.gotoXY(3,4);
-        display.print("->");
-        display.print("Left Hand");
-        display.print("<-");
+        display.print(F("->"));
+        display.print(F("Left Hand"));
+        display.print(F("<-"));
       }
     }
     else if(buttonB.getSingleDebouncedPress()) {
@@ -641,54 +1321,44 @@ void mazeRunner() {
   //Startup Delay
   display.clear();
   display.gotoXY(0,0);
-  display.print("Line Follow:         ");
+  display.print(F("Line Follow:         "));
   display.gotoXY(0,1);
-  display.print("Line Type: ");
+  display.print(F("Line Type: "));
   if (whiteLine) {
-    display.print("White Line");
+    display.print(F("White Line"));
   }
   else {
-    display.print("Black Line");
+    display.print(F("Black Line"));
   }
   display.gotoXY(0,2);
-  display.print("Search Rule: ");
+  display.print(F("Search Rule: "));
   if (rightHand) {
-    display.print("Right Hand");
+    display.print(F("Right Hand"));
   }
   else {
-    display.print("Left  Hand");
+    display.print(F("Left  Hand"));
   }
   display.gotoXY(0,3);
-  display.print("Calibration in: ");
-  display.print("3 ");
+  display.print(F("Calibration in: "));
+  display.print(F("3 "));
   delay(1000);
-  display.print("2 ");
+  display.print(F("2 "));
   delay(1000);
-  display.print("1 ");
+  display.print(F("1 "));
   delay(1000);
 
   //Calibration Loop
   display.clear();
   display.gotoXY(0,0);
-  display.print("Line Follow:         ");
+  display.print(F("Line Follow:         "));
   display.gotoXY(0,1);
-  display.print("Calibrating...");
+  display.print(F("Calibrating..."));
   display.gotoXY(0,6);
-  display.print("Press A to skip");
-  for (int i = 0; i<40; i++){
-    lineSensors.calibrate();
-    delay(100);
-    display.gotoXY(0,1);
-    display.print("Calibrating.. ");
-    display.gotoXY(16,1);
-    display.print(i*2);
-    display.print("%");
-    motors.setSpeeds(100, -100);
-  }
+  display.print(F("Press A to skip"));
+  calibrateLineSensors();
   //Wait for button press to start
-  motors.setSpeeds(0,0);
   display.gotoXY(0,6);
-  display.print("Press B to start");
+  display.print(F("Press B to start"));
   while(true) {
     if(buttonB.getSingleDebouncedPress()) {
       modeLoc = 20;
@@ -699,483 +1369,1583 @@ void mazeRunner() {
   //Startup Delay
   display.clear();
   display.gotoXY(0,0);
-  display.print("Starting in: ");
-  display.print("3 ");
+  display.print(F("Starting in: "));
+  display.print(F("3 "));
   delay(1000);
-  display.print("2 ");
+  display.print(F("2 "));
   delay(1000);
-  display.print("1 ");
+  display.print(F("1 "));
   delay(1000);
+  applyTunedGains();
+  routeMenu(exploreMaze());
+}
+
+//Exploration run from the start to the finish, then the post-finish
+//search if enabled. Returns the route menu item to offer first for
+//where the robot ended up.
+uint8_t exploreMaze() {
+  resetOdometry();
+  startFlightLog(true);
+  navigator.mapStart(navPose());
+
+  unsigned long straightStart, probeStart, ruleStart, turnStart;
+  int lastCount;
 
   //Line Follow Loop
   while (true) {
     //Standard Straight Segment Functionality
+    straightStart = millis();
     straightSegment();  
+    probeStart = millis();
 
-    //Crawl Forward to verify intersection detection
-    motors.setSpeeds(61,61);
-    delay(38); //Essential timing delay
-
-    leftMem = 0;
-    centerMem = 0;
-    rightMem = 0;
+    probeIntersection();
 
-    //Update Sensors after intersection detection and crawl
-    updateSensors();
-    leftMem = left;
-    rightMem = right;
-    display.gotoXY(0,1);
-    display.print(leftMem);
-    display.gotoXY(4,1);
-    display.print(rightMem);
-
-    
-    //Align to wheel
-    crawlFwd_alignToWheel();
-    motors.setSpeeds(0,0);
-    delay(100); //Non essential delay
-
-    //Update Sensors again
-    updateSensors();
-    if (center == 1 || sensVals[1] > 700 || sensVals[3] > 700) {
-      centerMem = 1;
-      display.gotoXY(2,1);
-      display.print(centerMem);
-    }
-    else {
-      centerMem = 0;
-      display.gotoXY(2,1);
-      display.print(centerMem);
+    ruleStart = millis();
+    JunctionAction action = searchRule();
+    junctionNode = IntersectionMap::NO_NODE;
+    if (action.decision == 'F' || action.kind == DECISION_RECORDED) {
+      junctionNode = navigator.mapArrive(action, junctionMem(), navPose(), IntersectionMap::NO_NODE);
     }
-
-    if(leftMem && centerMem && rightMem && left && center && right) {
+    if (action.decision == 'F') {
+      logIntersection(' ', EVENT_FINISH, straightStart, probeStart, ruleStart, ruleStart);
       break;
     }
     //decision upon Search Rule
+    display.gotoXY(0,3);
     if (rightHand) {
-      display.gotoXY(0,3);
-      display.print("Right Hand Rule");
-      rightHandRule();
-    }
-    else if (!rightHand){ 
-      display.gotoXY(0,3);
-      display.print("Left Hand Rule");
-      leftHandRule(); 
-    }
-    
-    if(leftMem == 0 && centerMem == 0 && rightMem == 1) {
-      decision = 'R';
+      display.print(F("Right Hand Rule"));
     }
-    if (decision == 'U' && rightMem) {
-      decision = 'R';
+    else {
+      display.print(F("Left Hand Rule"));
     }
+    pause(100);
+    decision = action.decision;
 
     display.gotoXY(19,0);
     display.print(decision);
     display.gotoXY(printCount,2);
     display.print(decision);
 
+    turnStart = millis();
     turnControl();
-    motors.setSpeeds(0,0);
-    delay(100); //Non essential delay
-
-    handleDecision(decision, centerMem, rightMem, leftMem, rightHand);
+    driveWheels(0, 0);
+    pause(100); //Non essential delay
+    navigator.mapLeave(decision, navPose());
+
+    lastCount = decisionCount;
+    handleDecision(decision, action.kind);
+    uint8_t flags = 0;
+    if (isForcedDecision) {flags |= EVENT_FORCED;}
+    if (decisionCount != lastCount) {flags |= EVENT_RECORDED;}
+    logIntersection(decision, flags, straightStart, probeStart, ruleStart, turnStart);
   }
 
-  display.clear();
-  while(true) { //Maze Solved Screen
-    display.gotoXY(0,0);
-    display.print("Maze Solved!     ");
-    display.gotoXY(0,1);
-    display.print("Recorded Path:   ");
-    display.gotoXY(0,2);
-    for(int i = 0; i <= decisionCount; i++) {
-      display.print(decisionHistory[i]);
-      if(i == 20) {
-        display.gotoXY(0,3);
+  optimizePath(decisionHistory, decisionCount);
+
+  if (postExploreS > 0 || postExploreMm > 0) {
+    if (!postExplore()) {
+      //no known way back, carried there instead
+      display.gotoXY(0,6);
+      display.print(F("Place on start    :B"));
+      while(!buttonB.getSingleDebouncedPress()) {
+        serviceConsole();
       }
     }
-    optimizePath(decisionHistory, decisionCount);
-    display.gotoXY(0,4);
-    display.print("Optimized Path:  ");
-    display.gotoXY(0,5);
-    for(int i = 0; i <= decisionCount; i++) {
-      display.print(optimizedPath[i]);
-    }
-    display.gotoXY(0,4);
-    if (rightHand) {display.print("Right Hand Rule");}
-    else {display.print("Left Hand Rule");}
+    return 0; //on the start
+  }
+  return 1; //on the finish, so Return first
+}
 
-    display.gotoXY(0,6);
-    display.print("SER-OUT RUN-OPT  QUIT");
-    display.gotoXY(0,7);
-    display.print(" A        B        C ");
-    if(buttonA.getSingleDebouncedPress()) {
-      for(int i = 0; i <= decisionCount; i++){
-        Serial.print(optimizedPath[i]);
+//Route menu: the optimized path can be run from the start and driven
+//back from the finish as often as wanted, without picking the robot up.
+//routeItem is the entry offered first.
+void routeMenu(uint8_t routeItem) {
+  int8_t modeLoc = 20;
+  while(modeLoc == 20) {
+    display.clear();
+    while(true) { //Maze Solved Screen
+      display.gotoXY(0,0);
+      display.print(F("Maze Solved!     "));
+      display.gotoXY(0,1);
+      display.print(F("Recorded Path:   "));
+      display.gotoXY(0,2);
+      for(int i = 0; i <= decisionCount; i++) {
+        display.print(decisionHistory[i]);
+        if(i == 20) {
+          display.gotoXY(0,3);
+        }
+      }
+      display.gotoXY(0,4);
+      display.print(F("Optimized Path:  "));
+      display.gotoXY(0,5);
+      for(int i = 0; i <= decisionCount; i++) {
+        display.print(optimizedPath[i]);
+      }
+      display.gotoXY(0,4);
+      if (rightHand) {display.print(F("Right Hand Rule"));}
+      else {display.print(F("Left Hand Rule"));}
+
+      display.gotoXY(0,6);
+      if (routeItem == 0) {display.print(F("Run Optimized   "));}
+      else if (routeItem == 1) {display.print(F("Return to Start "));}
+      else if (routeItem == 2) {display.print(F("Serial Out      "));}
+      else {display.print(F("Save Quick Run  "));}
+      display.print(F("\1/\2:A"));
+      display.gotoXY(0,7);
+      display.print(F("SEL:B          QUIT:C"));
+      if(buttonA.getSingleDebouncedPress()) {
+        routeItem = (routeItem + 1) % 4;
+      }
+      else if(buttonB.getSingleDebouncedPress()) {
+        if (routeItem == 2) {
+          for(int i = 0; i <= decisionCount; i++){
+            Serial.print(optimizedPath[i]);
+          }
+          Serial.println();
+          printRouteGeometry();
+          dumpFlightLog();
+        }
+        else if (routeItem == 3) {
+          display.gotoXY(0,6);
+          display.print(saveProfile(true) ? F("Quick Run Saved     ") : F("No Route To Save    "));
+          pause(500);
+        }
+        else {
+          modeLoc = routeItem == 0 ? 21 : 23;
+          break;
+        }
+      }
+      else if(buttonC.getSingleDebouncedPress()) {
+        modeLoc = 101;
+        break;
       }
     }
-    else if(buttonB.getSingleDebouncedPress()) {
-      modeLoc = 21;
+    if (modeLoc == 101) {
       break;
     }
-    else if(buttonC.getSingleDebouncedPress()) {
-      modeLoc = 101;
-      break;
+
+    display.clear();
+    display.gotoXY(0,0);
+    display.print(F("Running In: "));
+    display.print(F("3 "));
+    delay(1000);
+    display.print(F("2 "));
+    delay(1000);
+    display.print(F("1 "));
+    delay(1000);
+    startFlightLog(false);
+
+    if (modeLoc == 23) { //return to start, then offer the optimized run
+      runRoute(true);
+      routeItem = 0;
+      modeLoc = 20;
+      continue;
+    }
+    runRoute(false);
+    routeItem = 1;
+    modeLoc = 22;
+
+    if (benchmark) {
+      printBenchmark();
+      showBenchmark();
+      display.clear();
+    }
+
+    while(modeLoc == 22) {//Post run opt maze menu (final screen)
+      display.gotoXY(0,0);
+      display.print(F("Opt. Path Completed!"));
+      display.gotoXY(0,6);
+      display.print(F("LOG    SER-LOG   MENU"));
+      display.gotoXY(0,7);
+      display.print(F(" A        B        C "));
+      display.display();
+      if(buttonA.getSingleDebouncedPress()) {
+        viewFlightLog();
+        display.clear();
+      }
+      else if(buttonB.getSingleDebouncedPress()) {
+        dumpFlightLog();
+      }
+      else if(buttonC.getSingleDebouncedPress()) {
+        modeLoc = 20;
+      }
     }
   }
+}
 
-  display.gotoXY(0,0);
-  display.print("Running In: ");
-  display.print("3 ");
-  delay(1000);
-  display.print("2 ");
-  delay(1000);
-  display.print("1 ");
-  delay(1000);
+//Drives the reduced path from the start to the finish, or with back set
+//from the finish to the start: last turn first, each inverted. Lone
+//branches are taken as they come; every other intersection uses the
+//next turn of the route.
+//
+//With the route on the maze graph, each intersection is located on the
+//map from the distance since the last node and the branches seen, and
+//the route picks up wherever that is, so an intersection missed or
+//misread costs at most a detour. One that fits no node well short of
+//the next is a glitch and is driven straight through. One that fits
+//nothing loses the route: the search rule takes the robot on to the
+//finish, and the way back stops there. A stored route without the
+//graph only checks that the branch of each turn was seen. The
+//decisions are MazeNavigator's, see routeStep().
+void runRoute(bool back) {
+  unsigned long straightStart, probeStart, ruleStart, turnStart;
+  syncHeading();
+  navigator.routeStart(back, navPose());
+
+  if (back) {
+    //turn round on the finish pad and follow it off onto the line
+    decision = 'U';
+    turnControl();
+    driveWheels(0, 0);
+    pause(100);
+    navigator.mapLeave(decision, navPose());
+    resetLineControl();
+    do {
+      lineControlStep();
+    } while (frame.left || frame.right);
+  }
 
-while(modeLoc == 21) {// run optimized maze
+  while(true) {
       display.gotoXY(0,0);
-      display.print("Running Opt. Path...");
+      if (navigator.routeLost()) {display.print(F("Route lost: rule    "));}
+      else if (back) {display.print(F("Returning to Start.."));}
+      else {display.print(F("Running Opt. Path..."));}
         
 
       //Standard Straight Segment Functionality
+      straightStart = millis();
       straightSegment();  
+      probeStart = millis();
 
-      //Crawl Forward to verify intersection detection
-      motors.setSpeeds(61,61);
-      delay(38); //Essential timing delay
-
-      leftMem = 0;
-      centerMem = 0;
-      rightMem = 0;
-
-      //Update Sensors after intersection detection and crawl
-      updateSensors();
-      leftMem = left;
-      rightMem = right;
-      display.gotoXY(0,1);
-      display.print(leftMem);
-      display.gotoXY(4,1);
-      display.print(rightMem);
-
-      
-      //Align to wheel
-      crawlFwd_alignToWheel();
-      motors.setSpeeds(0,0);
-      delay(100); //Non essential delay
-
-      //Update Sensors again
-      updateSensors();
-      if (center == 1 || sensVals[1] > 700 || sensVals[3] > 700) {
-        centerMem = 1;
-        display.gotoXY(2,1);
-        display.print(centerMem);
-      }
-      else {
-        centerMem = 0;
-        display.gotoXY(2,1);
-        display.print(centerMem);
-      }
+      probeIntersection();
       //End of maze detection
-      if(leftMem && centerMem && rightMem && left && center && right || (optCount == decisionCount)) {
+      ruleStart = millis();
+      JunctionAction action = searchRule();
+      decision = navigator.routeStep(action, junctionMem(), navPose());
+      runStats[statsRun].relocations = navigator.relocations();
+      runStats[statsRun].routeLost = navigator.routeLost();
+      if (decision == 'F') {
+        logIntersection(' ', EVENT_FINISH | EVENT_OPT_RUN, straightStart, probeStart, ruleStart, ruleStart);
         display.clear();
-        motors.setSpeeds(0,0);
-        modeLoc = 22;
+        driveWheels(0, 0);
         break;
       }
-
-      if(!leftMem && !centerMem && rightMem) {
-        decision = 'R';
-      }
-      else if (leftMem && !centerMem && !rightMem) {
-        decision = 'L';
+      if (decision == 0) {
+        //the start cannot be found by rule; stop and wait to be carried
+        logIntersection(' ', EVENT_FINISH | EVENT_OPT_RUN, straightStart, probeStart, ruleStart, ruleStart);
+        driveWheels(0, 0);
+        display.gotoXY(0,0);
+        display.print(F("Route lost          "));
+        return;
       }
-      else {
-        optCount++;
-        decision = optimizedPath[optCount];
+
+      uint8_t flags = EVENT_OPT_RUN;
+      if (action.kind == DECISION_FORCED) {
+        flags |= EVENT_FORCED;
       }
-      if (decision == 'U' && rightMem) {
-        decision = 'R';
+      else if (action.kind == DECISION_RECORDED) {
+        flags |= EVENT_RECORDED;
       }
 
       display.gotoXY(0,1);
       display.print(decision);
 
       //Run decision
+      turnStart = millis();
       turnControl();
-      motors.setSpeeds(0,0);
-      delay(100);
+      driveWheels(0, 0);
+      pause(100);
+      navigator.mapLeave(decision, navPose());
+      logIntersection(decision, flags, straightStart, probeStart, ruleStart, turnStart);
   }
-  
-  while(modeLoc == 22) {//Post run opt maze menu (final screen)
-    display.gotoXY(0,0);
-    display.print("Opt. Path Completed!");
 
+  if (back) {
+    //face the maze again, ready for the next timed run
+    decision = 'U';
+    turnControl();
+    driveWheels(0, 0);
   }
 }
 
-//==================== Utility Functions ==========================
+//==================== Maze Map ===================================
+
+//Follows the line from the current node to the next one, taking lone
+//branches on the way, and returns that node
+uint8_t driveLink(uint8_t expected) {
+  if (navigator.node() == navigator.finishNode()) {
+    //follow the pad off onto the line first
+    resetLineControl();
+    do {
+      lineControlStep();
+    } while (frame.left || frame.right);
+  }
+  while (true) {
+    straightSegment();
+    probeIntersection();
+    JunctionAction action = searchRule();
+    if (action.decision == 'F' || action.kind == DECISION_RECORDED) {
+      return navigator.mapArrive(action, junctionMem(), navPose(), expected);
+    }
+    decision = action.decision;
+    turnControl();
+    driveWheels(0, 0);
+    pause(100);
+  }
+}
 
-// Helper function to shift the array elements to the left
-void shiftArrayLeft(char path[], int start, int shiftBy, int &len) {
-    for (int i = start; i < len - shiftBy; i++) {
-        path[i] = path[i + shiftBy];
+//Drives the shortest known route from the current node to target.
+//Returns false if the graph has no route there.
+bool driveTo(uint8_t target) {
+  while (navigator.node() != target) {
+    uint8_t expected;
+    decision = navigator.turnTowards(target, expected);
+    if (decision == 0) {
+      return false;
     }
-    len -= shiftBy;
+    turnControl();
+    driveWheels(0, 0);
+    pause(100);
+    navigator.mapLeave(decision, navPose());
+    driveLink(expected);
+  }
+  return true;
 }
 
-// Path optimizer function
-void optimizePath(char path[], int &decisionCount) {
-  bool simplified = true;
-  int optIndex = 0;
-  int u = 0;
-
-  while (simplified) {
-    simplified = false;
-    optIndex = 0;
-
-    for (int i = 0; i <= decisionCount; ++i) {
-      // Check for patterns of 3 decisions to apply simplification rules
-      if (i < decisionCount - 1) {
-        if (path[i] == 'S' && path[i + 1] == 'U' && path[i + 2] == 'L') {
-          optimizedPath[optIndex++] = 'R';
-          i += 2; // Skip two additional positions
-          simplified = true;
-          continue;
-        } else if (path[i] == 'S' && path[i + 1] == 'U' && path[i + 2] == 'R') {
-          optimizedPath[optIndex++] = 'L';
-          i += 2; // Skip two additional positions
-          simplified = true;
-          continue;
-        } else if (path[i] == 'L' && path[i + 1] == 'U' && path[i + 2] == 'S') {
-          optimizedPath[optIndex++] = 'R';
-          i += 2; // Skip two additional positions
-          simplified = true;
-          continue;
-        } else if (path[i] == 'R' && path[i + 1] == 'U' && path[i + 2] == 'S') {
-          optimizedPath[optIndex++] = 'L';
-          i += 2; // Skip two additional positions
-          simplified = true;
-          continue;
-        } else if (path[i] == 'L' && path[i + 1] == 'U' && path[i + 2] == 'L') {
-          optimizedPath[optIndex++] = 'S';
-          i += 2; // Skip two additional positions
-          simplified = true;
-          continue;
-        } else if (path[i] == 'R' && path[i + 1] == 'U' && path[i + 2] == 'R') {
-          optimizedPath[optIndex++] = 'S';
-          i += 2; // Skip two additional positions
-          simplified = true;
-          continue;
-        } else if (path[i] == 'R' && path[i + 1] == 'U' && path[i + 2] == 'L') {
-          optimizedPath[optIndex++] = 'U';
-          i += 2; // Skip two additional positions
-          simplified = true;
-          continue;
-        } else if (path[i] == 'L' && path[i + 1] == 'U' && path[i + 2] == 'R') {
-          optimizedPath[optIndex++] = 'U';
-          i += 2; // Skip two additional positions
-          simplified = true;
-          continue;
-        } else if (path[i] == 'S' && path[i + 1] == 'U' && path[i + 2] == 'S') {
-          optimizedPath[optIndex++] = 'U';
-          i += 2; // Skip two additional positions
-          simplified = true;
-          continue;
-        }
+//After the finish: follows unexplored exits that could still give a
+//shorter route, nearest bound first, until the best known route is
+//provably the shortest or a budget runs out. Then drives to the start
+//and replaces the optimized path with the best route found.
+bool postExplore() {
+  unsigned long startMs = millis();
+  int32_t startDist = status.distance;
+  RoutePlan plan = PLAN_EXPLORE;
+
+  display.clear();
+  display.gotoXY(0,0);
+  display.print(F("Exploring more...   "));
+  while (true) {
+    if (postExploreS > 0 && millis() - startMs >= postExploreS * 1000UL) {break;}
+    if (postExploreMm > 0 && fx::ticksToMm(status.distance - startDist) >= postExploreMm) {break;}
+    uint8_t node, dir;
+    plan = navigator.plan(node, dir);
+    if (plan != PLAN_EXPLORE) {
+      break;
+    }
+    display.gotoXY(0,3);
+    display.print(F("Target node "));
+    display.print(node);
+    display.print(F("   "));
+    if (!driveTo(node)) {
+      break;
+    }
+    decision = navigator.turnOnto(dir);
+    turnControl();
+    driveWheels(0, 0);
+    pause(100);
+    navigator.mapLeave(decision, navPose());
+    driveLink(IntersectionMap::NO_NODE);
+  }
+
+  display.gotoXY(0,0);
+  display.print(plan == PLAN_OPTIMAL ? F("Route optimal       ") : F("Budget used up      "));
+  display.gotoXY(0,3);
+  display.print(F("Back to start       "));
+  bool home = driveTo(navigator.startNode());
+  if (home) {
+    //face the maze again, ready for the optimized run
+    decision = 'U';
+    turnControl();
+  }
+  driveWheels(0, 0);
+
+  navigator.takeBestRoute(decisionHistory, MAX_DECISIONS);
+  return home;
+}
+
+//==================== Flight Recorder ============================
+
+//Marks the start of a run. The optimized run keeps the exploration
+//events and appends its own.
+void startFlightLog(bool clear) {
+  if (clear) {
+    flightLog.clear();
+    statsRun = 0;
+  }
+  else {
+    statsRun = 1;
+  }
+  memset(&runStats[statsRun], 0, sizeof(RunStats));
+  runStartTime = millis();
+  runStartDist = status.distance;
+  logSlips = status.slips;
+}
+
+//Records one intersection with the time spent in each phase
+void logIntersection(char decision, uint8_t flags, unsigned long straightStart, unsigned long probeStart, unsigned long ruleStart, unsigned long turnStart) {
+  unsigned long now = millis();
+  IntersectionEvent event;
+
+  if (leftMem) {flags |= EVENT_LEFT;}
+  if (centerMem) {flags |= EVENT_CENTER;}
+  if (rightMem) {flags |= EVENT_RIGHT;}
+  uint16_t slips = status.slips - logSlips;
+  logSlips = status.slips;
+  if (slips > 0) {flags |= EVENT_SLIP;}
+
+  event.time = probeStart - runStartTime;
+  event.distance = fx::ticksToMm(status.distance - runStartDist);
+  event.decision = decision;
+  event.flags = flags;
+  event.straightMs = probeStart - straightStart;
+  event.probeMs = ruleStart - probeStart;
+  event.ruleMs = turnStart - ruleStart;
+  event.turnMs = now - turnStart;
+  flightLog.add(event);
+
+  RunStats& stats = runStats[statsRun];
+  stats.straightMs += event.straightMs;
+  stats.probeMs += event.probeMs;
+  stats.ruleMs += event.ruleMs;
+  stats.turnMs += event.turnMs;
+  stats.intersections++;
+  stats.slips += slips;
+  if (flags & EVENT_RECORDED) {
+    stats.decisions++;
+  }
+  if (flags & EVENT_FINISH) {
+    stats.totalMs = now - runStartTime;
+  }
+}
+
+//Fixed stationary delay, counted for the benchmark.
+//The tuning console is serviced while waiting.
+void pause(uint16_t ms) {
+  unsigned long start = millis();
+  while (millis() - start < ms) {
+    serviceConsole();
+  }
+  runStats[statsRun].delayMs += ms;
+}
+
+//==================== Tuning Console =============================
+// Line-based commands over USB serial:
+//   list               all parameters
+//   get <name>         one parameter
+//   set <name> <value> write a parameter (clamped to its range)
+//   save / load        commit to / reload from EEPROM
+//   mem                SRAM budget
+//   quick save         store the quick run profile, without a route
+//   quick clear        drop it; boot goes to the main menu
+//   tele on / off      binary line control frames, see lib/Telemetry
+
+//Collects serial input and runs complete lines. Never blocks.
+void serviceConsole() {
+  while (Serial.available() > 0) {
+    char c = Serial.read();
+    if (c == '\r') {
+      continue;
+    }
+    if (c == '\n') {
+      consoleLine[consoleLen] = 0;
+      if (consoleLen > 0) {
+        runConsoleCommand(consoleLine);
       }
-      // If no pattern is found, add the current decision
-      optimizedPath[optIndex++] = path[i];
+      consoleLen = 0;
+    }
+    else if (consoleLen < sizeof(consoleLine) - 1) {
+      consoleLine[consoleLen++] = c;
+    }
+  }
+}
+
+void printParam(const TuneParam& param) {
+  Serial.print((const __FlashStringHelper*)param.name);
+  Serial.print('=');
+  Serial.println(*param.value);
+}
+
+//Copies the named entry into param. Returns its index, or -1.
+int8_t findParam(const char* name, TuneParam& param) {
+  for (uint8_t i = 0; i < tuneParamCount; i++) {
+    memcpy_P(&param, &tuneParams[i], sizeof(TuneParam));
+    if (strcmp_P(name, param.name) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+void runConsoleCommand(char* line) {
+  TuneParam param;
+  char* cmd = strtok(line, " =");
+  char* name = strtok(NULL, " =");
+  char* value = strtok(NULL, " =");
+  if (!cmd) {
+    return; //blank line
+  }
+
+  if (strcmp_P(cmd, PSTR("list")) == 0) {
+    for (uint8_t i = 0; i < tuneParamCount; i++) {
+      memcpy_P(&param, &tuneParams[i], sizeof(TuneParam));
+      printParam(param);
+    }
+  }
+  else if (strcmp_P(cmd, PSTR("get")) == 0 && name && findParam(name, param) >= 0) {
+    printParam(param);
+  }
+  else if (strcmp_P(cmd, PSTR("set")) == 0 && name && value && findParam(name, param) >= 0) {
+    int16_t v = atoi(value);
+    *param.value = constrain(v, param.min, param.max);
+    printParam(param);
+  }
+  else if (strcmp_P(cmd, PSTR("save")) == 0) {
+    saveParams();
+    Serial.println(F("saved"));
+  }
+  else if (strcmp_P(cmd, PSTR("load")) == 0) {
+    Serial.println(loadParams() ? F("loaded") : F("err: nothing saved"));
+  }
+  else if (strcmp_P(cmd, PSTR("mem")) == 0) {
+    printMemory();
+  }
+  else if (strcmp_P(cmd, PSTR("quick")) == 0 && name && strcmp_P(name, PSTR("save")) == 0) {
+    saveProfile(false);
+    Serial.println(F("saved"));
+  }
+  else if (strcmp_P(cmd, PSTR("quick")) == 0 && name && strcmp_P(name, PSTR("clear")) == 0) {
+    clearProfile();
+    Serial.println(F("cleared"));
+  }
+  else if (strcmp_P(cmd, PSTR("tele")) == 0 && name && (strcmp_P(name, PSTR("on")) == 0 || strcmp_P(name, PSTR("off")) == 0)) {
+    telemetryOn = strcmp_P(name, PSTR("on")) == 0;
+  }
+  else {
+    Serial.println(F("err: list | get <name> | set <name> <value> | save | load | mem | quick save|clear | tele on|off"));
+  }
+}
+
+//Streams the line control step just taken. Skipped, with the sequence
+//number still counting, when the USB endpoint has no room, so a slow
+//host shows up as gaps instead of stalling the loop.
+void sendTelemetry() {
+  TelemetryFrame t;
+  uint8_t out[telemetry::FRAME_BYTES];
+  t.seq = telemetrySeq++;
+  if (Serial.availableForWrite() < telemetry::FRAME_BYTES) {
+    return;
+  }
+  t.timeUs = frame.sampleUs;
+  for (uint8_t i = 0; i < 5; i++) {
+    t.vals[i] = frame.vals[i];
+  }
+  t.predict = frame.predict;
+  t.deviation = deviation;
+  t.motorL = motorSpeedL;
+  t.motorR = motorSpeedR;
+  t.decision = decision;
+  t.flags = 0;
+  if (frame.left) {t.flags |= TELEMETRY_LEFT;}
+  if (frame.center) {t.flags |= TELEMETRY_CENTER;}
+  if (frame.right) {t.flags |= TELEMETRY_RIGHT;}
+  if (frame.onLine) {t.flags |= TELEMETRY_ON_LINE;}
+  telemetry::encode(t, out);
+  Serial.write(out, telemetry::FRAME_BYTES);
+}
+
+//SRAM figures in bytes, one name=value per line. freemin is the
+//closest the stack has come to the heap since reset.
+void printMemory() {
+  MemoryReport m = mem::report();
+  Serial.print(F("sram="));
+  Serial.println(m.total);
+  Serial.print(F("data="));
+  Serial.println(m.data);
+  Serial.print(F("bss="));
+  Serial.println(m.bss);
+  Serial.print(F("heap="));
+  Serial.println(m.heap);
+  Serial.print(F("heappeak="));
+  Serial.println(m.heapPeak);
+  Serial.print(F("stackpeak="));
+  Serial.println(m.stackPeak);
+  Serial.print(F("free="));
+  Serial.println(m.free);
+  Serial.print(F("freemin="));
+  Serial.println(m.freeMin);
+}
+
+//Stores every parameter in table order
+void saveParams() {
+  TuneParam param;
+  int addr = eepromParams;
+  EEPROM.update(addr++, paramsMagic);
+  EEPROM.update(addr++, tuneParamCount);
+  for (uint8_t i = 0; i < tuneParamCount; i++) {
+    memcpy_P(&param, &tuneParams[i], sizeof(TuneParam));
+    EEPROM.put(addr, *param.value);
+    addr += sizeof(int16_t);
+  }
+}
+
+//Restores saved parameters. Ignored if nothing was saved or the
+//table layout changed since.
+bool loadParams() {
+  TuneParam param;
+  int addr = eepromParams;
+  if (EEPROM.read(addr++) != paramsMagic || EEPROM.read(addr++) != tuneParamCount) {
+    return false;
+  }
+  for (uint8_t i = 0; i < tuneParamCount; i++) {
+    int16_t v;
+    memcpy_P(&param, &tuneParams[i], sizeof(TuneParam));
+    EEPROM.get(addr, v);
+    *param.value = constrain(v, param.min, param.max);
+    addr += sizeof(int16_t);
+  }
+  return true;
+}
+
+//==================== Quick Start ================================
+
+//Stores the current line type, rule, speed and gains as the quick run
+//profile, with the sensor calibration if there is one and, if withRoute,
+//the optimized route. False, with nothing written, when the route is
+//asked for and there is no optimized path to store.
+bool saveProfile(bool withRoute) {
+  if (withRoute && decisionCount < 0) {
+    return false;
+  }
+  RunProfile profile;
+  memset(&profile, 0, sizeof(profile));
+  profile.magic = profileMagic;
+  if (whiteLine) {profile.flags |= PROFILE_WHITE_LINE;}
+  if (rightHand) {profile.flags |= PROFILE_RIGHT_HAND;}
+  profile.speed = motorSpeed;
+  profile.kp = Kp;
+  profile.kd = Kd;
+  if (lineSensors.calibrationOn.initialized && ambient.isCalibrated()) {
+    profile.flags |= PROFILE_CALIBRATION;
+    memcpy(profile.lineMin, lineSensors.calibrationOn.minimum, sizeof(profile.lineMin));
+    memcpy(profile.lineMax, lineSensors.calibrationOn.maximum, sizeof(profile.lineMax));
+    ambient.getCalibration(profile.ambientMin, profile.ambientMax);
+  }
+  profile.routeCount = -1;
+  if (withRoute) {
+    profile.flags |= PROFILE_ROUTE;
+    profile.routeCount = decisionCount;
+    for (int i = 0; i <= decisionCount; i++) {
+      EEPROM.update(eepromProfileRoute + i, optimizedPath[i]);
+    }
+  }
+  EEPROM.put(eepromProfile, profile);
+  return true;
+}
+
+//Reads the stored profile. False if there is none.
+bool readProfile(RunProfile& profile) {
+  EEPROM.get(eepromProfile, profile);
+  if (profile.magic != profileMagic || profile.routeCount >= MAX_DECISIONS) {
+    return false;
+  }
+  return !(profile.flags & PROFILE_ROUTE) || profile.routeCount >= 0;
+}
+
+//Makes a stored profile the current settings, calibration and route
+void applyProfile(const RunProfile& profile) {
+  whiteLine = profile.flags & PROFILE_WHITE_LINE;
+  rightHand = profile.flags & PROFILE_RIGHT_HAND;
+  motorSpeed = profile.speed;
+  Kp = profile.kp;
+  Kd = profile.kd;
+  if (profile.flags & PROFILE_CALIBRATION) {
+    lineSensors.calibrate(); //allocates the calibration arrays
+    memcpy(lineSensors.calibrationOn.minimum, profile.lineMin, sizeof(profile.lineMin));
+    memcpy(lineSensors.calibrationOn.maximum, profile.lineMax, sizeof(profile.lineMax));
+    ambient.setCalibration(profile.ambientMin, profile.ambientMax);
+  }
+  if (profile.flags & PROFILE_ROUTE) {
+    decisionCount = profile.routeCount;
+    for (int i = 0; i <= decisionCount; i++) {
+      optimizedPath[i] = EEPROM.read(eepromProfileRoute + i);
+      decisionHistory[i] = optimizedPath[i];
+    }
+  }
+}
+
+void clearProfile() {
+  EEPROM.update(eepromProfile, 0xFF);
+}
+
+//Drives the stored profile with no menus or countdowns: the timed run
+//of the stored route, or an exploration if there is none. Without a
+//stored calibration it spins first and waits for B, as mazeRunner does.
+void quickRun() {
+  RunProfile profile;
+  if (!readProfile(profile)) {
+    return;
+  }
+  applyProfile(profile);
+  display.clear();
+  if (!(profile.flags & PROFILE_CALIBRATION)) {
+    display.gotoXY(0,0);
+    display.print(F("Quick Run:           "));
+    calibrateLineSensors();
+    display.gotoXY(0,6);
+    display.print(F("Press B to start"));
+    while(!buttonB.getSingleDebouncedPress()) {
+      serviceConsole();
     }
+    display.clear();
+  }
+
+  if (profile.flags & PROFILE_ROUTE) {
+    resetOdometry();
+    startFlightLog(true);
+    runRoute(false);
+    routeMenu(1);
+  }
+  else {
+    routeMenu(exploreMaze());
+  }
+}
+
+//==================== Benchmark ==================================
+
+//Prints both runs' time breakdown over serial
+void printBenchmark() {
+  static const char names[][12] PROGMEM = {"Exploration", "Optimized"};
+  Serial.print(F("Benchmark, firmware " FIRMWARE_VERSION));
+  Serial.print(F(", speed "));
+  Serial.print(motorSpeed);
+  Serial.print(F(", Kp "));
+  Serial.print(Kp);
+  Serial.print(F(", Kd "));
+  Serial.println(Kd);
+  for (uint8_t i = 0; i < 2; i++) {
+    const RunStats& st = runStats[i];
+    Serial.println((const __FlashStringHelper*)names[i]);
+    Serial.print(F("  total_ms: "));
+    Serial.println(st.totalMs);
+    Serial.print(F("  straight_ms: "));
+    Serial.println(st.straightMs);
+    Serial.print(F("  probe_ms: "));
+    Serial.println(st.probeMs);
+    Serial.print(F("  rule_ms: "));
+    Serial.println(st.ruleMs);
+    Serial.print(F("  turn_ms: "));
+    Serial.println(st.turnMs);
+    Serial.print(F("  fixed_delay_ms: "));
+    Serial.println(st.delayMs);
+    Serial.print(F("  oled_ms: "));
+    Serial.println(st.oledUs / 1000);
+    Serial.print(F("  intersections: "));
+    Serial.println(st.intersections);
+    Serial.print(F("  decisions: "));
+    Serial.println(st.decisions);
+    Serial.print(F("  wheel_slips: "));
+    Serial.println(st.slips);
+    Serial.print(F("  relocations: "));
+    Serial.println(st.relocations);
+    Serial.print(F("  route_lost: "));
+    Serial.println(st.routeLost);
+  }
+}
+
+//Shows the breakdown on the OLED, A toggles between the two pages
+void showBenchmark() {
+  static const char labels[][7] PROGMEM = {"Total", "Strght", "Probe", "Rule", "Turn", "Delay", "OLED", "Inters", "Decs", "Slips", "Reloc"};
+  uint8_t first = 0;
+  bool redraw = true;
+  driveWheels(0, 0);
 
-    // Copy the optimized path back to the original array
-    for (int i = 0; i < optIndex; i++) {
-      path[i] = optimizedPath[i];
+  while(true) {
+    if (redraw) {
+      redraw = false;
+      display.clear();
+      display.gotoXY(0,0);
+      display.print(F("Bench ms  Expl   Opt"));
+      for (uint8_t item = first; item < first + 6 && item < 11; item++) {
+        uint8_t row = item - first + 1;
+        display.gotoXY(0,row);
+        display.print((const __FlashStringHelper*)labels[item]);
+        for (uint8_t i = 0; i < 2; i++) {
+          const RunStats& st = runStats[i];
+          unsigned long v = 0;
+          switch (item) {
+            case 0: v = st.totalMs; break;
+            case 1: v = st.straightMs; break;
+            case 2: v = st.probeMs; break;
+            case 3: v = st.ruleMs; break;
+            case 4: v = st.turnMs; break;
+            case 5: v = st.delayMs; break;
+            case 6: v = st.oledUs / 1000; break;
+            case 7: v = st.intersections; break;
+            case 8: v = st.decisions; break;
+            case 9: v = st.slips; break;
+            case 10: v = st.relocations; break;
+          }
+          display.gotoXY(9 + i * 6,row);
+          display.print(v);
+        }
+      }
+      display.gotoXY(0,7);
+      display.print(F("More :A       Done :C"));
+      display.display();
+    }
+    if (buttonA.getSingleDebouncedPress()) {
+      first = first == 0 ? 6 : 0;
+      redraw = true;
     }
+    if (buttonC.getSingleDebouncedPress()) {
+      break;
+    }
+  }
+}
+
+//Writes the log as CSV, oldest event first
+void dumpFlightLog() {
+  Serial.print(F("Flight log, events: "));
+  Serial.println(flightLog.total());
+  Serial.println(F("idx,t_ms,dist_mm,L,C,R,dec,forced,recorded,finish,opt,slip,straight_ms,probe_ms,rule_ms,turn_ms"));
+  for (uint8_t i = 0; i < flightLog.count(); i++) {
+    const IntersectionEvent& e = flightLog.get(i);
+    Serial.print(flightLog.total() - flightLog.count() + i);
+    Serial.print(',');
+    Serial.print(e.time);
+    Serial.print(',');
+    Serial.print(e.distance);
+    Serial.print(',');
+    Serial.print((e.flags & EVENT_LEFT) != 0);
+    Serial.print(',');
+    Serial.print((e.flags & EVENT_CENTER) != 0);
+    Serial.print(',');
+    Serial.print((e.flags & EVENT_RIGHT) != 0);
+    Serial.print(',');
+    Serial.print(e.decision);
+    Serial.print(',');
+    Serial.print((e.flags & EVENT_FORCED) != 0);
+    Serial.print(',');
+    Serial.print((e.flags & EVENT_RECORDED) != 0);
+    Serial.print(',');
+    Serial.print((e.flags & EVENT_FINISH) != 0);
+    Serial.print(',');
+    Serial.print((e.flags & EVENT_OPT_RUN) != 0);
+    Serial.print(',');
+    Serial.print((e.flags & EVENT_SLIP) != 0);
+    Serial.print(',');
+    Serial.print(e.straightMs);
+    Serial.print(',');
+    Serial.print(e.probeMs);
+    Serial.print(',');
+    Serial.print(e.ruleMs);
+    Serial.print(',');
+    Serial.println(e.turnMs);
+  }
+}
+
+//Pages through the log on the OLED, one event per page
+void viewFlightLog() {
+  uint8_t page = 0;
+  bool redraw = true;
 
-    // Verify if the optimized path still contains any U-turns
-    u = 0;
-    for (int i = 0; i < optIndex; ++i) {
-      if (optimizedPath[i] == 'U') {
-        u++;
+  display.clear();
+  while(true) {
+    if (redraw) {
+      redraw = false;
+      display.clear();
+      display.gotoXY(0,0);
+      display.print(F("Flight Log "));
+      if (flightLog.count() == 0) {
+        display.gotoXY(0,2);
+        display.print(F("No events recorded"));
+      }
+      else {
+        const IntersectionEvent& e = flightLog.get(page);
+        display.print(F("#"));
+        display.print(flightLog.total() - flightLog.count() + page);
+        display.print(F("/"));
+        display.print(flightLog.total() - 1);
+        display.gotoXY(0,1);
+        display.print(e.time);
+        display.print(F("ms "));
+        display.print(e.distance);
+        display.print(F("mm"));
+        display.gotoXY(0,2);
+        display.print(F("LCR "));
+        display.print((e.flags & EVENT_LEFT) != 0);
+        display.print((e.flags & EVENT_CENTER) != 0);
+        display.print((e.flags & EVENT_RIGHT) != 0);
+        display.print(F(" Dec "));
+        display.print(e.decision);
+        display.gotoXY(0,3);
+        if (e.flags & EVENT_FINISH) {display.print(F("Finish "));}
+        else if (e.flags & EVENT_RECORDED) {display.print(F("Recorded "));}
+        else if (e.flags & EVENT_FORCED) {display.print(F("Forced "));}
+        if (e.flags & EVENT_OPT_RUN) {display.print(F("(opt)"));}
+        if (e.flags & EVENT_SLIP) {display.print(F(" Slip"));}
+        display.gotoXY(0,4);
+        display.print(F("Straight "));
+        display.print(e.straightMs);
+        display.print(F(" Probe "));
+        display.print(e.probeMs);
+        display.gotoXY(0,5);
+        display.print(F("Rule "));
+        display.print(e.ruleMs);
+        display.print(F(" Turn "));
+        display.print(e.turnMs);
       }
+      display.gotoXY(0,7);
+      display.print(F("\2 A    \1 B    Back\7C"));
+      display.display();
+    }
+
+    if (buttonA.getSingleDebouncedPress() && page + 1 < flightLog.count()) {
+      page++;
+      redraw = true;
+    }
+    else if (buttonB.getSingleDebouncedPress() && page > 0) {
+      page--;
+      redraw = true;
     }
-    if (u == 0) {
-      decisionCount = optIndex - 1;
+    if (buttonC.getSingleDebouncedPress()) {
       break;
     }
   }
 }
 
+//==================== Utility Functions ==========================
 
-//Raw encoder to degree conversion
-float tick2deg(int ticks) {
-  float deg;
-  deg = ticks * (1.0/12.0) * (1.0/29.86) * (360);
-  return deg;
+// Path optimizer, see maze::optimizePath
+void optimizePath(char path[], int &decisionCount) {
+  maze::optimizePath(path, optimizedPath, decisionCount);
 }
 
-//Reads sensors and updates isolations
-void updateSensors() {
-  lineSensors.readCalibrated(lineSensVals);
-
-  sensVals[0] = lineSensVals[0]; //left
-  sensVals[1] = lineSensVals[1];
-  sensVals[2] = lineSensVals[2]; //center
-  sensVals[3] = lineSensVals[3];
-  sensVals[4] = lineSensVals[4]; //right
-
-  if(whiteLine) {
-    predict = lineSensors.readLineWhite(lineSensVals);
-    sensVals[0] = 1000 - sensVals[0];
-    sensVals[1] = 1000 - sensVals[1];
-    sensVals[2] = 1000 - sensVals[2];
-    sensVals[3] = 1000 - sensVals[3];
-    sensVals[4] = 1000 - sensVals[4];
+// Branches remembered at the current intersection
+Junction junctionMem() {
+  Junction j = {leftMem, centerMem, rightMem};
+  return j;
+}
+
+// Pose for the maze navigator, from the last status snapshot
+NavPose navPose() {
+  NavPose pose = {status.distance, status.x, status.y, status.heading};
+  return pose;
+}
+
+//Reads the battery and updates the motor scale factor.
+//Readings are low-pass filtered since they sag under motor load.
+void sampleBattery(bool reset) {
+  uint16_t mv = readBatteryMillivolts();
+  batteryTime = millis();
+  if (reset) {
+    batteryMv = mv;
   }
   else {
-    predict = lineSensors.readLineBlack(lineSensVals);
+    batteryMv = batteryMv + ((int16_t)(mv - batteryMv) / 4);
   }
 
-  leftInt = sensVals[0];
-  centerInt = sensVals[2];
-  rightInt = sensVals[4];
+  if (batteryMv < minBatteryMv) {
+    batteryScale = 4096;
+  }
+  else {
+    batteryScale = ((int32_t)nominalMv << 12) / batteryMv;
+  }
+}
 
-  if(leftInt > 700){left = 1;} 
-  else {left = 0;}
+//Motor command scaled by a Q12 battery factor, limited to -400..400
+int16_t scaleToBattery(int16_t speed, int32_t scale) {
+  int32_t out = ((int32_t)speed * scale + 2048) >> 12;
+  return constrain(out, -400, 400);
+}
 
-  if(centerInt > 700){center = 1;} 
-  else {center = 0;}
+//Sets both motors directly, compensated for battery voltage.
+//Used while the control interrupt does not own the motors.
+void setMotorSpeeds(int16_t left, int16_t right) {
+  if (millis() - batteryTime >= batteryPeriod) {
+    sampleBattery(false);
+  }
+  motors.setSpeeds(scaleToBattery(left, batteryScale), scaleToBattery(right, batteryScale));
+}
 
-  if(rightInt > 700){right = 1;} 
-  else {right = 0;}
+//Commands both wheels in motor units. With velocity control on, these
+//are converted to wheel speeds that the control interrupt holds
+//regardless of load and motor mismatch. Zero stops the motors and hands
+//them back to the foreground.
+void driveWheels(int16_t left, int16_t right) {
+  if (millis() - batteryTime >= batteryPeriod) {
+    sampleBattery(false);
+  }
+  command.batteryScale = batteryScale;
+  if (!velocityControl || (left == 0 && right == 0)) {
+    //the interrupt sees this before the motors change below
+    command.active = false;
+    controlCommand.write(command);
+    setMotorSpeeds(left, right);
+    return;
+  }
+  command.active = true;
+  command.targetL = fx::motorToMmPerSec(left);
+  command.targetR = fx::motorToMmPerSec(right);
+  controlCommand.write(command);
+}
 
-  display.gotoXY(0,0);
-  display.print(left);
-  display.print(" ");
-  display.print(center);
-  display.print(" ");
-  display.print(right);
-  display.print("              ");
-  display.gotoXY(0,3);
+//==================== Control Interrupt ==========================
+
+//Timer3 in CTC mode, prescaler 8: 2 MHz / controlHz
+void startControlTimer() {
+  ctrlCountsL = encoders.getCountsLeft();
+  ctrlCountsR = encoders.getCountsRight();
+  controlCommand.write(command);
+  noInterrupts();
+  TCCR3A = 0;
+  TCCR3B = _BV(WGM32) | _BV(CS31);
+  OCR3A = (F_CPU / 8) / controlHz - 1;
+  TCNT3 = 0;
+  TIMSK3 = _BV(OCIE3A);
+  interrupts();
 }
 
-void crawlFwd_alignToWheel() {
-  motors.setSpeeds(40, 40);
-  delay(140);
+//Non-blocking so encoder, USB and millis() interrupts stay on time
+//while the tick runs; ctrlBusy drops a tick that would nest.
+ISR(TIMER3_COMPA_vect, ISR_NOBLOCK) {
+  if (ctrlBusy) {
+    return;
+  }
+  ctrlBusy = true;
+  controlTick();
+  controlTicks++;
+  ctrlBusy = false;
 }
 
-char leftHandRule() {
-  delay(50);
-  if(leftMem){
-    delay(50);
-    decision = 'L';
-    return 'L';
+//One control interrupt tick. Runs with interrupts enabled, but never
+//preempted by the foreground.
+void controlTick() {
+  ControlCommand cmd;
+  controlCommand.read(cmd);
+
+  bool odomDue = ++ctrlPhase >= odomDiv;
+  if (cmd.resetSeq != ctrlResetSeq) {
+    odometry.reset();
+    slipGuard.reset();
+    ctrlResetSeq = cmd.resetSeq;
+    odomDue = true;
   }
-  else if(centerMem){
-    delay(50);
-    decision = 'S';
-    return 'S';
+  if (cmd.slipSeq != ctrlSlipSeq) {
+    slipGuard.slipped();
+    ctrlSlipSeq = cmd.slipSeq;
   }
-  else if(rightMem){
-    delay(50);
-    decision = 'R';
-    return 'R';
+  if (cmd.active && !ctrlActive) {
+    //starts from standstill; a stop brakes at once, unramped
+    wheelL.reset();
+    wheelR.reset();
+    slipGuard.restart();
+    ctrlRampL = 0;
+    ctrlRampR = 0;
   }
-  else {
-    delay(50);
-    decision = 'U';
-    return 'U';
+  ctrlActive = cmd.active;
+  if (cmd.active) {
+    ctrlRampL = slipGuard.ramp(ctrlRampL, cmd.targetL, 1000 / controlHz);
+    ctrlRampR = slipGuard.ramp(ctrlRampR, cmd.targetR, 1000 / controlHz);
+  }
+
+  int16_t outL = wheelL.output(ctrlRampL);
+  int16_t outR = wheelR.output(ctrlRampR);
+  if (odomDue) {
+    ctrlPhase = 0;
+    int16_t countsL = encoders.getCountsLeft();
+    int16_t countsR = encoders.getCountsRight();
+    int16_t dL = countsL - ctrlCountsL;
+    int16_t dR = countsR - ctrlCountsR;
+    ctrlCountsL = countsL;
+    ctrlCountsR = countsR;
+    odometry.update(dL, dR);
+    if (cmd.active) {
+      outL = wheelL.update(ctrlRampL, dL, 1000 / controlHz * odomDiv);
+      outR = wheelR.update(ctrlRampR, dR, 1000 / controlHz * odomDiv);
+      slipGuard.update(ctrlRampL, ctrlRampR, dL, dR, 1000 / controlHz * odomDiv);
+    }
+
+    ControlStatus st;
+    st.distance = odometry.distance();
+    st.x = odometry.xMm();
+    st.y = odometry.yMm();
+    st.heading = odometry.heading();
+    st.speedL = wheelL.speed();
+    st.speedR = wheelR.speed();
+    st.slips = slipGuard.slipCount();
+    st.turnScaleQ8 = slipGuard.turnScaleQ8();
+    st.resetSeq = ctrlResetSeq;
+    controlStatus.write(st);
+  }
+
+  if (cmd.active) {
+    motors.setSpeeds(scaleToBattery(outL, cmd.batteryScale), scaleToBattery(outR, cmd.batteryScale));
+  }
+}
+
+//Raw encoder to degree conversion
+int32_t tick2deg(int32_t ticks) {
+  return fx::ticksToDeg(ticks);
+}
+
+//Zeroes the pose and clears the intersection map at the start of a run,
+//and restores the full slip limits from the current tunables.
+//Returns once the control interrupt has published the zeroed pose.
+void resetOdometry() {
+  noInterrupts();
+  slipGuard.accelMax = accMax;
+  slipGuard.accelMin = accMin;
+  slipGuard.slipAccel = slipAcc;
+  interrupts();
+  command.resetSeq++;
+  controlCommand.write(command);
+  do {
+    updateOdometry();
+  } while (status.resetSeq != command.resetSeq);
+  syncHeading();
+}
+
+//Takes the latest pose published by the control interrupt (10 ms rate)
+void updateOdometry() {
+  controlStatus.read(status);
+  encCountsAvg = fx::ticksToMm(status.distance);
+}
+
+//Keeps pose, heading and wheel speeds current inside motion loops
+void serviceMotion() {
+  updateOdometry();
+  updateHeading();
+}
+
+//Prints where each optimized decision is taken and the estimated length
+//of the optimized route, to check it against the physical maze. The
+//nodes come from walking the route over the maze graph.
+void printRouteGeometry() {
+  uint32_t length = 0;
+  uint8_t node = navigator.startNode();
+  uint8_t prev = IntersectionMap::NO_NODE;
+  uint8_t dir = 0;
+  for(int i = 0; i <= decisionCount; i++) {
+    if (node != IntersectionMap::NO_NODE) {
+      node = mazeGraph.follow(node, dir, optimizedPath[i]);
+    }
+    Serial.print(optimizedPath[i]);
+    if (node == IntersectionMap::NO_NODE) {
+      Serial.println(F(" ?"));
+      continue;
+    }
+    Serial.print(F(" ("));
+    Serial.print(intersections.node(node).x);
+    Serial.print(F(", "));
+    Serial.print(intersections.node(node).y);
+    Serial.print(F(") visits "));
+    Serial.println(intersections.node(node).visits);
+    if (prev != IntersectionMap::NO_NODE) {
+      length += intersections.distance(prev, node);
+    }
+    prev = node;
   }
+  Serial.print(F("Nodes: "));
+  Serial.print(intersections.count());
+  Serial.print(F(" Revisits: "));
+  Serial.println(intersections.revisits());
+  Serial.print(F("Opt. route length (mm): "));
+  Serial.println(length);
 }
 
-char rightHandRule() {
-  delay(50);
-  if(rightMem){
-    delay(50);
-    decision = 'R';
-    return 'R';
-  } 
-  else if(centerMem){
-    delay(50);
-    decision = 'S';
-    return 'S';
+//Reads sensors once and updates the shared sensor frame.
+//Line position is computed here from the calibrated values instead of
+//calling readLineBlack/readLineWhite, which would read the sensors again.
+void updateSensors() {
+  uint32_t weighted = 0;
+  uint16_t sum = 0;
+  bool onLine = false;
+
+  serviceMotion();
+  unsigned long readStart = micros();
+  readLineSensors(lineSensVals);
+  frame.sampleUs = readStart + (micros() - readStart) / 2;
+
+  for (uint8_t i = 0; i < 5; i++) {
+    uint16_t val = lineSensVals[i];
+    if (whiteLine) {
+      val = 1000 - val;
+    }
+    frame.vals[i] = val;
+
+    //same weighting as the Pololu library's readLine
+    if (val > 200) {
+      onLine = true;
+    }
+    if (val > 50) {
+      weighted += (uint32_t)val * (i * 1000);
+      sum += val;
+    }
   }
-  else if(leftMem){
-    delay(50);
-    decision = 'L';
-    return 'L';
+
+  if (!onLine) {
+    //line lost, hold the side it was last seen on
+    if (frame.predict < midPoint) {frame.predict = 0;}
+    else {frame.predict = 4000;}
   }
   else {
-    delay(50);
-    decision = 'U';
-    return 'U';
+    frame.predict = weighted / sum;
+  }
+
+  frame.onLine = onLine;
+  frame.left = frame.vals[0] > lineThreshold;
+  frame.center = frame.vals[2] > lineThreshold;
+  frame.right = frame.vals[4] > lineThreshold;
+
+  unsigned long oledStart = micros();
+  display.gotoXY(0,0);
+  display.print(frame.left);
+  display.print(F(" "));
+  display.print(frame.center);
+  display.print(F(" "));
+  display.print(frame.right);
+  display.print(F("              "));
+  display.gotoXY(0,3);
+  runStats[statsRun].oledUs += micros() - oledStart;
+}
+
+void crawlFwd_alignToWheel() {
+  crawlStraight(alignSpeed, alignMs);
+}
+
+//Crawls onto a detected intersection and reads which branches it has
+//into leftMem, centerMem and rightMem
+void probeIntersection() {
+  //Crawl Forward to verify intersection detection
+  crawlStraight(crawlSpeed, crawlMs); //Essential timing delay
+
+  //Update Sensors after intersection detection and crawl
+  updateSensors();
+  leftMem = frame.left;
+  rightMem = frame.right;
+  display.gotoXY(0,1);
+  display.print(leftMem);
+  display.gotoXY(4,1);
+  display.print(rightMem);
+
+  //Align to wheel
+  crawlFwd_alignToWheel();
+  driveWheels(0, 0);
+  pause(100); //Non essential delay
+
+  //Update Sensors again
+  updateSensors();
+  centerMem = frame.center || frame.vals[1] > lineThreshold || frame.vals[3] > lineThreshold;
+  display.gotoXY(2,1);
+  display.print(centerMem);
+}
+
+//Averages the gyro z rate while the robot stands still
+void calibrateGyro() {
+  display.clear();
+  display.gotoXY(0,0);
+  display.print(F("Gyro calibration... "));
+  display.display();
+
+  headingFilter.startCalibration();
+  for (uint16_t i = 0; i < gyroCalSamples; i++) {
+    while (!imu.gyroDataReady()) {}
+    imu.readGyro();
+    headingFilter.addCalibrationSample(imu.g.z);
+  }
+  headingFilter.finishCalibration();
+  headingFilter.reset();
+  syncHeading();
+}
+
+//Starts the heading increments afresh. The wheels turn with nothing
+//calling updateHeading() during the calibration spin, the menus and
+//while the robot is carried back; those turns are no part of a run
+//and would read as slip against the gyro.
+void syncHeading() {
+  headingTime = micros();
+  headCountsL = encoders.getCountsLeft();
+  headCountsR = encoders.getCountsRight();
+  headingFilter.clearSlipAngle();
+}
+
+//Feeds the latest gyro rate and encoder increments to the heading filter
+void updateHeading() {
+  unsigned long now = micros();
+  unsigned long dt = now - headingTime;
+  headingTime = now;
+
+  int16_t countsL = encoders.getCountsLeft();
+  int16_t countsR = encoders.getCountsRight();
+  int16_t gyroZ = 0;
+  if (imuOk) {
+    imu.readGyro();
+    gyroZ = imu.g.z;
+  }
+  if (dt > 50000) {dt = 50000;}
+  headingFilter.update(gyroZ, dt, countsL - headCountsL, countsR - headCountsR);
+  headCountsL = countsL;
+  headCountsR = countsR;
+
+  //wheels turned the robot further than the gyro saw: slip
+  if (imuOk && slipDeg > 0 && abs(headingFilter.slipAngle()) >= fx::degToBrad(slipDeg)) {
+    headingFilter.clearSlipAngle();
+    command.slipSeq++;
+    controlCommand.write(command);
+  }
+}
+
+//Drives forward for ms, steering back to the heading it started with
+void crawlStraight(int16_t speed, uint16_t ms) {
+  serviceMotion();
+  uint16_t target = headingFilter.heading();
+  unsigned long start = millis();
+  while (millis() - start < ms) {
+    serviceMotion();
+    //positive error means the robot drifted left
+    int16_t error = headingFilter.heading() - target;
+    int16_t adj = (int32_t)error * headingHoldKp / 256;
+    adj = constrain(adj, -speed / 2, speed / 2);
+    driveWheels(speed + adj, speed - adj);
+  }
+}
+
+//Pivot speed after SlipGuard's slowdown for slips seen this run
+int16_t pivotSpeed() {
+  return fx::mulQ8(turnSpeed, status.turnScaleQ8);
+}
+
+//Spins in place until the heading changed by deg (positive = left).
+//Gives up after twice the old timed-turn duration, stretched for a
+//slowed pivot.
+void turnBy(int16_t deg) {
+  int16_t mag = abs(deg);
+  int32_t target = fx::degToBrad(mag - turnLeadDeg);
+  unsigned long timeout = (unsigned long)mag * 40 / 9 * 256 / status.turnScaleQ8; //ms
+  int32_t turned = 0;
+  int16_t speed = pivotSpeed();
+
+  updateHeading();
+  uint16_t last = headingFilter.heading();
+  if (deg > 0) {driveWheels(-speed, speed);}
+  else {driveWheels(speed, -speed);}
+
+  unsigned long start = millis();
+  while (millis() - start < timeout) {
+    serviceMotion();
+    uint16_t now = headingFilter.heading();
+    turned += (int16_t)(now - last);
+    last = now;
+    if (abs(turned) >= target) {
+      break;
+    }
   }
 }
 
+//Search rule decision for the probed intersection: one table lookup on
+//the branches seen, the finish pad and the rule side
+JunctionAction searchRule() {
+  bool finish = frame.left && frame.center && frame.right;
+  return maze::junctionAction(maze::junctionCode(junctionMem(), finish, rightHand));
+}
+
 void straightSegment() {
   display.gotoXY(0,4);
-  display.print("Straight          ");
-  lastDeviation = 0;
+  display.print(F("Straight          "));
+  resetLineControl();
   while(true) {
-    updateSensors();
-    //Simple Line Follower Control
-    deviation = predict - midPoint;
-    motorSpeedAdj = deviation * (int32_t)Kp / 256  + (deviation - lastDeviation) * (int32_t)Kd / 256;
-    lastDeviation = deviation;
+    lineControlStep();
 
-    motorSpeedL = (int16_t)motorSpeed + motorSpeedAdj;
-    motorSpeedR = (int16_t)motorSpeed - motorSpeedAdj;
+    //Condition to check for intersection
+    if (!frame.center && frame.vals[1] < gapThreshold && frame.vals[3] < gapThreshold) {
+      if (recoverLine()) {
+        continue;
+      }
+      return;
+    }
+    else if (frame.left || frame.right) {
 
-    motorSpeedL = constrain(motorSpeedL, motorSpeed*(0.7), (int16_t)motorSpeed);
-    motorSpeedR = constrain(motorSpeedR, motorSpeed*(0.7), (int16_t)motorSpeed);
+      return;
+    }
+  }
+}
 
-    motors.setSpeeds(motorSpeedL, motorSpeedR);
-    //Print Motor Speeds
-    display.gotoXY(0,5); 
-    display.print(motorSpeedL);
-    display.print(" ");
-    display.print(motorSpeedR);
-    display.print("    ");
+//Inner sensors back on the line after a loss
+bool lineReacquired() {
+  return frame.center || frame.vals[1] >= gapThreshold || frame.vals[3] >= gapThreshold;
+}
 
-    //Condition to check for intersection
-    if (center == 0 && sensVals[1] < 600 && sensVals[3] < 600) {
+//Tells a line that slid away from one that ended. Returns true with the
+//line back under the inner sensors, false with the robot facing the way
+//it was when the line was lost, for the probe to take as before.
+bool recoverLine() {
+  int16_t lost = lineControl.lastDeviation();
+  if (recoverDev == 0 || abs(lost) < recoverDev) {
+    return false; //lost while centered: the line ended or a junction
+  }
 
-      return;
+  //the follower keeps steering to the side last seen (updateSensors
+  //holds predict there), which picks up most short losses
+  int32_t window = fx::mmToTicks(lossMm);
+  int32_t start = status.distance;
+  while (status.distance - start < window) {
+    lineControlStep();
+    if (lineReacquired()) {
+      return true;
     }
-    else if (left == 1 || right == 1) {
+  }
 
-      return;
+  //bounded pivot towards that side, then back if nothing is found
+  int32_t target = fx::degToBrad(recoverDeg);
+  unsigned long timeout = (unsigned long)recoverDeg * 80 / 9 * 256 / status.turnScaleQ8; //ms, twice a turnBy
+  int32_t turned = 0;
+  int16_t speed = pivotSpeed();
+  updateHeading();
+  uint16_t last = headingFilter.heading();
+  if (lost > 0) {driveWheels(speed, -speed);}
+  else {driveWheels(-speed, speed);}
+  unsigned long t0 = millis();
+  while (millis() - t0 < timeout && abs(turned) < target) {
+    updateSensors();
+    uint16_t now = headingFilter.heading();
+    turned += (int16_t)(now - last);
+    last = now;
+    if (lineReacquired()) {
+      resetLineControl();
+      return true;
     }
   }
+  driveWheels(0, 0);
+  int16_t back = fx::bradToDeg((int16_t)turned);
+  if (abs(back) > turnLeadDeg) {
+    turnBy(-back);
+  }
+  driveWheels(0, 0);
+  return false;
+}
+
+//One iteration of the line follower PID on a fresh sensor frame
+void lineControlStep() {
+  //hold the fixed line loop rate, sampling on a control tick. The
+  //ambient read fills the last idle tick before it, so it only costs
+  //loop time when the loop is already overrunning.
+  while ((uint8_t)(controlTicks - lineTick) + 1 < linePeriod) {}
+  if (ambientUs > 0) {
+    readAmbient();
+  }
+  while ((uint8_t)(controlTicks - lineTick) < linePeriod) {}
+  lineTick = controlTicks;
+  updateSensors();
+  //Simple Line Follower Control, with the curvature feed-forward
+  LineCommand cmd = lineControl.step(lineGains(), frame.predict - midPoint, frame.onLine, frame.sampleUs,
+    micros(), encoders.getCountsLeft(), encoders.getCountsRight());
+  deviation = cmd.deviation;
+  motorSpeedAdj = cmd.adj;
+  motorSpeedL = cmd.left;
+  motorSpeedR = cmd.right;
+
+  driveWheels(motorSpeedL, motorSpeedR);
+  if (telemetryOn) {
+    sendTelemetry();
+  }
+  //Print Motor Speeds
+  unsigned long oledStart = micros();
+  display.gotoXY(0,5); 
+  display.print(motorSpeedL);
+  display.print(F(" "));
+  display.print(motorSpeedR);
+  display.print(F("    "));
+  runStats[statsRun].oledUs += micros() - oledStart;
+}
+
+//Clears the PID history and the line and curvature estimates for a new segment
+void resetLineControl() {
+  lineControl.reset(lineGains(), encoders.getCountsLeft(), encoders.getCountsRight());
+}
+
+//The line follower tunables as LineControl takes them
+LineGains lineGains() {
+  LineGains gains = {motorSpeed, minMotorSpeed, Kp, Kd, minSpeedRatio, curveControl, latAcc, ffGain,
+    estAlpha, estBeta, leadUs, linePeriod};
+  return gains;
+}
+
+//Emitters-off read with the short ambientUs timeout, kept for the next
+//readLineSensors()
+void readAmbient() {
+  uint16_t off[5];
+  uint16_t timeout = lineSensors.getTimeout();
+  lineSensors.setTimeout(ambientUs);
+  lineSensors.read(off, LineSensorsReadMode::Off);
+  lineSensors.setTimeout(timeout);
+  ambient.setAmbient(off, ambientUs);
+  ambientFresh = true;
+}
+
+//Calibrated line sensor read, 0..1000, with the ambient light removed
+//unless ambientUs is 0. Takes its own off read if the line loop has not.
+void readLineSensors(uint16_t* vals) {
+  if (ambientUs == 0 || !ambient.isCalibrated()) {
+    lineSensors.readCalibrated(vals);
+    return;
+  }
+  if (!ambientFresh) {
+    readAmbient();
+  }
+  lineSensors.read(vals, LineSensorsReadMode::On);
+  ambient.subtract(vals, lineSensors.getTimeout());
+  ambient.calibrated(vals);
+  ambientFresh = false;
+}
+
+//One calibration sample for both the plain and the ambient-free reads
+void calibrateSensors() {
+  uint16_t vals[5];
+  lineSensors.calibrate();
+  readAmbient();
+  lineSensors.read(vals, LineSensorsReadMode::On);
+  ambient.subtract(vals, lineSensors.getTimeout());
+  ambient.calibrate(vals);
+  ambientFresh = false;
+}
+
+//Spins in place over the line while calibrating the sensors
+void calibrateLineSensors() {
+  for (int i = 0; i<40; i++){
+    calibrateSensors();
+    delay(100);
+    display.gotoXY(0,1);
+    display.print(F("Calibrating.. "));
+    display.gotoXY(16,1);
+    display.print(i*2);
+    display.print(F("%"));
+    setMotorSpeeds(100, -100);
+  }
+  driveWheels(0, 0);
 }
 
 void turnControl() {
-  delay(50);
+  pause(50);
   switch (decision) {
       case 'R': //RIGHT TURN
         display.gotoXY(0,4);
-        display.print("Right Turn        ");
-        motors.setSpeeds(96, -96);
-        delay(200);
+        display.print(F("Right Turn        "));
+        turnBy(-90);
         break;
       case 'L': //LEFT TURN
         display.gotoXY(0,4);
-        display.print("Left Turn         ");
-        motors.setSpeeds(-96, 96);
-        delay(200);
+        display.print(F("Left Turn         "));
+        turnBy(90);
         break;
       case 'U': //U-TURN
         display.gotoXY(0,4);
-        display.print("U-Turn            ");
-        motors.setSpeeds(96,-96);
-		    delay(400);
+        display.print(F("U-Turn            "));
+        turnBy(-180);
         break;
        // END U-TURN
       case 'S': //STRAIGHT PATH
         display.gotoXY(0,4);
-        display.print("Straight          ");
+        display.print(F("Straight          "));
         break; //END STRAIGHT
       }
 }
@@ -1183,40 +2953,27 @@ void turnControl() {
 // Function to store a decision in the history
 void storeDecision(char decision) {
   if (decision != ' ' && !isForcedDecision) { // Avoid storing forced or empty decisions
-    decisionCount++;
-    decisionHistory[decisionCount] = decision;
+    // Intersection it was made at, shown with it
+    uint8_t node = junctionNode;
+    if (!maze::storeDecision(decisionHistory, decisionCount, MAX_DECISIONS, decision)) {
+      return;
+    }
+    display.gotoXY(0,6);
+    display.print(F("Node "));
+    display.print(node);
+    if (node != IntersectionMap::NO_NODE && intersections.node(node).visits > 1) {
+      display.print(F(" revisit   "));
+    }
+    else {
+      display.print(F("           "));
+    }
   }
 }
 
 // Function to handle decisions and store valid ones
-void handleDecision(char decision, bool centerMem, bool rightMem, bool leftMem, bool rightHand) {
-  isForcedDecision = false; // Reset the forced decision flag for each new decision
-
-  if (decision == 'U') { // Record U-turn
-    decisionMem = decision;
-    storeDecision(decision);
-  } else if (decision == 'R' && centerMem && rightMem && !leftMem) { // Record right turns to the right
-    decisionMem = decision;
-    storeDecision(decision);
-  } else if (decision == 'L' && !rightHand && centerMem && !rightMem && leftMem) { // Record left turns to the left
-    decisionMem = decision;
-    storeDecision(decision);
-  } else if (decision == 'S' && rightHand && centerMem && !rightMem && leftMem) { // Record left turns in right hand mode (S)
-    decisionMem = decision;
-    storeDecision(decision);
-  } else if (decision == 'S' && !rightHand && centerMem && rightMem && !leftMem) { // Record right turns in right hand mode (S)
-    decisionMem = decision;
-    storeDecision(decision);
-  } else if (decision == 'L' && leftMem && !centerMem && !rightMem) { // Forced left turn
-    decision = ' '; // Clear the current decision
-    isForcedDecision = true; // Mark as a forced decision
-  } else if (decision == 'R' && !leftMem && !centerMem && rightMem) { // Forced right turn
-    decision = ' '; // Clear the current decision
-    isForcedDecision = true; // Mark as a forced decision
-  } else if (decision == 'R' && rightHand && rightMem && leftMem) { // T turns with right hand mode
-    decisionMem = decision;
-    storeDecision(decision);
-  } else if (decision == 'L' && !rightHand && rightMem && leftMem) { // T turns with left hand mode
+void handleDecision(char decision, DecisionKind kind) {
+  isForcedDecision = kind == DECISION_FORCED;
+  if (kind == DECISION_RECORDED) {
     decisionMem = decision;
     storeDecision(decision);
   }
@@ -1225,6 +2982,9 @@ void handleDecision(char decision, bool centerMem, bool rightMem, bool leftMem,
   if (decisionMem != ' ') { // Only print valid decisions
     display.print(decisionMem);
     printCount++;
+    if (printCount > 20) { // Wrap at the display width
+      printCount = 0;
+    }
   }
 }
 
@@ -0,0 +1,283 @@
+//===============================
+// test_fixed_point
+// Host unit tests of the FixedPoint library. Each conversion is swept
+// over the whole input range its comment gives ("Valid for |x| < N")
+// and checked against a double reference. The allowed error is the
+// output rounding plus what rounding the scale factor to its Q format
+// can add at that input, so a constant that loses precision or a range
+// that overflows 32 bits fails here. The compile-time spot checks in
+// FixedPoint.h stay as they are.
+//
+//   pio test -e native -f test_fixed_point
+//===============================
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unity.h>
+#include <FixedPoint.h>
+
+using namespace fx;
+
+void setUp() {}
+void tearDown() {}
+
+//Largest error of fn against ref over lo..hi, each relative to its
+//bound: above 1.0 somewhere means the bound is broken there.
+template <typename Fn, typename Ref, typename Bound>
+static double sweep(long lo, long hi, long step, Fn fn, Ref ref, Bound bound) {
+  double worst = 0;
+  long worstAt = lo;
+  for (long x = lo; x <= hi; x += step) {
+    double ratio = fabs((double)fn(x) - ref(x)) / bound(x);
+    if (ratio > worst) {
+      worst = ratio;
+      worstAt = x;
+    }
+  }
+  if (worst > 1.0) {
+    char line[80];
+    snprintf(line, sizeof(line), "worst at x = %ld, %.2f times the bound", worstAt, worst);
+    TEST_MESSAGE(line);
+  }
+  return worst;
+}
+
+//Rounded output plus a Qn scale factor off by up to half an LSB
+static double qBound(long x, uint8_t bits) {
+  return 0.5 + labs(x) / (double)(2UL << bits) + 1e-9;
+}
+
+void test_sweep_catches_an_error_past_the_bound() {
+  //off by one and a half bounds: the ratio must be compared as a double,
+  //an integer assert would truncate it to 1 and pass
+  double worst = sweep(-100, 100, 1,
+    [](long x) {return x + 1.5;},
+    [](long x) {return (double)x;},
+    [](long) {return 1.0;});
+  TEST_ASSERT_FALSE(worst <= 1.0);
+}
+
+//==================== Distance and Angle =========================
+
+void test_ticks_to_deg() {
+  double worst = sweep(-31999, 31999, 1,
+    [](long t) {return ticksToDeg(t);},
+    [](long t) {return t * 360.0 / TICKS_PER_REV;},
+    [](long t) {return qBound(t, 16);});
+  TEST_ASSERT_TRUE(worst <= 1.0);
+}
+
+void test_deg_to_ticks() {
+  double worst = sweep(-31999, 31999, 1,
+    [](long d) {return degToTicks(d);},
+    [](long d) {return d * TICKS_PER_REV / 360.0;},
+    [](long d) {return qBound(d, 16);});
+  TEST_ASSERT_TRUE(worst <= 1.0);
+}
+
+void test_ticks_to_mm() {
+  double worst = sweep(-99999, 99999, 1,
+    [](long t) {return ticksToMm(t);},
+    [](long t) {return t * MM_PER_TICK;},
+    [](long t) {return qBound(t, 16);});
+  TEST_ASSERT_TRUE(worst <= 1.0);
+}
+
+void test_mm_to_ticks() {
+  double worst = sweep(-8999, 8999, 1,
+    [](long mm) {return mmToTicks(mm);},
+    [](long mm) {return mm / MM_PER_TICK;},
+    [](long mm) {return qBound(mm, 16);});
+  TEST_ASSERT_TRUE(worst <= 1.0);
+}
+
+void test_deg_to_brad() {
+  double worst = sweep(-31999, 31999, 1,
+    [](long d) {return degToBrad(d);},
+    [](long d) {return d * 65536.0 / 360.0;},
+    [](long d) {return qBound(d, 8);});
+  TEST_ASSERT_TRUE(worst <= 1.0);
+}
+
+void test_brad_to_deg() {
+  double worst = sweep(-32768, 32767, 1,
+    [](long b) {return bradToDeg((int16_t)b);},
+    [](long b) {return b * 360.0 / 65536.0;},
+    [](long b) {return qBound(b, 16);});
+  TEST_ASSERT_TRUE(worst <= 1.0);
+}
+
+void test_diff_ticks_to_brad() {
+  //headings wrap, so the error is taken the short way round
+  double worst = sweep(-249999, 249999, 1,
+    [](long t) {return diffTicksToBrad(t);},
+    [](long t) {
+      double brad = t * MM_PER_TICK / TRACK_MM * 65536.0 / (2.0 * PI_D);
+      return diffTicksToBrad(t) - remainder(diffTicksToBrad(t) - brad, 65536.0);
+    },
+    [](long t) {return qBound(t, 8);});
+  TEST_ASSERT_TRUE(worst <= 1.0);
+}
+
+//==================== Trigonometry ===============================
+
+void test_sin_cos_over_the_full_circle() {
+  //the documented error, 0.0003, in Q14 units
+  const double bound = 0.0003 * 16384;
+  double worst = sweep(0, 65535, 1,
+    [](long b) {return sinQ14((uint16_t)b);},
+    [](long b) {return 16384.0 * sin(b * 2.0 * PI_D / 65536.0);},
+    [bound](long) {return bound;});
+  TEST_ASSERT_TRUE(worst <= 1.0);
+  worst = sweep(0, 65535, 1,
+    [](long b) {return cosQ14((uint16_t)b);},
+    [](long b) {return 16384.0 * cos(b * 2.0 * PI_D / 65536.0);},
+    [bound](long) {return bound;});
+  TEST_ASSERT_TRUE(worst <= 1.0);
+}
+
+void test_sin_exact_at_the_quadrants() {
+  TEST_ASSERT_EQUAL_INT(0, sinQ14(0));
+  TEST_ASSERT_EQUAL_INT(16384, sinQ14(0x4000));
+  TEST_ASSERT_EQUAL_INT(0, sinQ14(0x8000));
+  TEST_ASSERT_EQUAL_INT(-16384, sinQ14(0xC000));
+  TEST_ASSERT_EQUAL_INT(16384, cosQ14(0));
+}
+
+//==================== Roots ======================================
+
+static void assertFloorRoot(uint32_t x) {
+  uint32_t r = isqrt32(x);
+  //r * r <= x < (r + 1)^2, without overflowing at the top of the range
+  TEST_ASSERT_TRUE(r * r <= x);
+  TEST_ASSERT_TRUE(r == 0xFFFF || (r + 1) * (r + 1) > x);
+}
+
+void test_isqrt_small_inputs() {
+  for (uint32_t x = 0; x <= 200000; x++) {
+    assertFloorRoot(x);
+  }
+}
+
+void test_isqrt_around_every_square() {
+  for (uint32_t r = 1; r <= 0xFFFF; r++) {
+    assertFloorRoot(r * r - 1);
+    assertFloorRoot(r * r);
+  }
+  assertFloorRoot(0xFFFFFFFFUL);
+  TEST_ASSERT_EQUAL_INT(0xFFFF, isqrt32(0xFFFFFFFFUL));
+}
+
+void test_isqrt_spread_over_32_bits() {
+  for (uint32_t x = 7; x < 0xFFF00000UL; x += 104729) {
+    assertFloorRoot(x);
+  }
+}
+
+//==================== Speed ======================================
+
+void test_ticks_to_mm_per_sec() {
+  //UM_PER_TICK is a whole number of um and the division truncates
+  for (uint16_t dt = 1; dt <= 100; dt++) {
+    double worst = sweep(-6999, 6999, 1,
+      [dt](long t) {return ticksToMmPerSec(t, dt);},
+      [dt](long t) {return t * MM_PER_TICK * 1000.0 / dt;},
+      [dt](long t) {return 1.0 + labs(t) * 0.5 / dt;});
+    TEST_ASSERT_TRUE(worst <= 1.0);
+  }
+  TEST_ASSERT_EQUAL_INT(0, ticksToMmPerSec(100, 0));
+}
+
+void test_mm_per_sec_to_ticks() {
+  for (uint16_t dt = 1; dt <= 100; dt++) {
+    double worst = sweep(-3000, 3000, 1,
+      [dt](long v) {return mmPerSecToTicks(v, dt);},
+      [dt](long v) {return v * (double)dt / (MM_PER_TICK * 1000.0);},
+      [dt](long v) {return 1.0 + labs(v) * dt * 0.5 / ((double)UM_PER_TICK * UM_PER_TICK);});
+    TEST_ASSERT_TRUE(worst <= 1.0);
+  }
+}
+
+void test_motor_units() {
+  double worst = sweep(-400, 400, 1,
+    [](long s) {return motorToMmPerSec(s);},
+    [](long s) {return s * MM_PER_SEC_AT_400 / 400.0;},
+    [](long s) {return qBound(s, 8);});
+  TEST_ASSERT_TRUE(worst <= 1.0);
+  worst = sweep(-1500, 1500, 1,
+    [](long v) {return mmPerSecToMotor(v);},
+    [](long v) {return v * 400.0 / MM_PER_SEC_AT_400;},
+    [](long v) {return qBound(v, 8);});
+  TEST_ASSERT_TRUE(worst <= 1.0);
+}
+
+//==================== Curvature ==================================
+
+void test_curvature() {
+  //the division truncates and the Q8 factor is off by up to half an LSB;
+  //short distances take it past 16 bits, where it saturates
+  for (int16_t mm = 10; mm <= 500; mm++) {
+    double worst = sweep(-1999, 1999, 1,
+      [mm](long d) {return curvatureQ8(d, mm);},
+      [mm](long d) {return fmax(-32767.0, fmin(32767.0, d * MM_PER_TICK / TRACK_MM * 1000.0 * 256.0 / mm));},
+      [mm](long d) {return 1.0 + labs(d) * 0.5 / mm;});
+    TEST_ASSERT_TRUE(worst <= 1.0);
+  }
+  TEST_ASSERT_EQUAL_INT(0, curvatureQ8(100, 0));
+}
+
+void test_line_offset() {
+  double worst = sweep(-2500, 2500, 1,
+    [](long dev) {return lineOffsetMm(dev);},
+    [](long dev) {return -dev * LINE_PITCH_MM / 1000.0;},
+    [](long) {return 1.0;});
+  TEST_ASSERT_TRUE(worst <= 1.0);
+}
+
+void test_curve_wheel_offset() {
+  //two truncating steps: under one unit from the last, and under one
+  //unit of speed times curvature scaled by the half track from the first
+  const double bound = 1.0 + TRACK_MM / 2000.0 + 0.1;
+  for (long speed = -400; speed <= 400; speed++) {
+    double worst = sweep(-5120, 5120, 8,
+      [speed](long c) {return curveWheelOffset(speed, c);},
+      [speed](long c) {return speed * c / 256.0 * TRACK_MM / 2000.0;},
+      [bound](long) {return bound;});
+    TEST_ASSERT_TRUE(worst <= 1.0);
+  }
+}
+
+//==================== Time =======================================
+
+void test_time() {
+  for (uint32_t us = 0; us < 2000000UL; us += 7) {
+    TEST_ASSERT_EQUAL_INT((uint32_t)floor(us / 1000.0 + 0.5), usToMs(us));
+  }
+  TEST_ASSERT_EQUAL_INT(4000000000UL, msToUs(4000000UL));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_sweep_catches_an_error_past_the_bound);
+  RUN_TEST(test_ticks_to_deg);
+  RUN_TEST(test_deg_to_ticks);
+  RUN_TEST(test_ticks_to_mm);
+  RUN_TEST(test_mm_to_ticks);
+  RUN_TEST(test_deg_to_brad);
+  RUN_TEST(test_brad_to_deg);
+  RUN_TEST(test_diff_ticks_to_brad);
+  RUN_TEST(test_sin_cos_over_the_full_circle);
+  RUN_TEST(test_sin_exact_at_the_quadrants);
+  RUN_TEST(test_isqrt_small_inputs);
+  RUN_TEST(test_isqrt_around_every_square);
+  RUN_TEST(test_isqrt_spread_over_32_bits);
+  RUN_TEST(test_ticks_to_mm_per_sec);
+  RUN_TEST(test_mm_per_sec_to_ticks);
+  RUN_TEST(test_motor_units);
+  RUN_TEST(test_curvature);
+  RUN_TEST(test_line_offset);
+  RUN_TEST(test_curve_wheel_offset);
+  RUN_TEST(test_time);
+  return UNITY_END();
+}
@@ -0,0 +1,154 @@
+//===============================
+// test_maze_decision
+// Host unit tests of the MazeDecision library: the junction table
+// against the search rules, decision storage at the capacity limit and
+// path optimization, including a second pass that must not read entries
+// the first one dropped.
+//
+//   pio test -e native -f test_maze_decision
+//===============================
+
+#include <string.h>
+#include <unity.h>
+#include <MazeDecision.h>
+
+void setUp() {}
+void tearDown() {}
+
+static JunctionAction act(bool l, bool c, bool r, bool finish, bool rightHand) {
+  Junction j = {l, c, r};
+  return maze::junctionAction(maze::junctionCode(j, finish, rightHand));
+}
+
+static void assertAction(char decision, DecisionKind kind, JunctionAction a) {
+  TEST_ASSERT_EQUAL_CHAR(decision, a.decision);
+  TEST_ASSERT_EQUAL_INT(kind, a.kind);
+}
+
+//Reduces path in place and checks the result
+static void assertOptimized(const char* path, const char* expected) {
+  char in[32];
+  char out[32];
+  int count = (int)strlen(path) - 1;
+  memcpy(in, path, count + 1);
+  maze::optimizePath(in, out, count);
+  TEST_ASSERT_EQUAL_INT((int)strlen(expected) - 1, count);
+  TEST_ASSERT_EQUAL_STRING_LEN(expected, in, count + 1);
+}
+
+//==================== Junction Table ============================
+
+void test_left_hand_rule() {
+  assertAction('L', DECISION_RECORDED, act(true, true, true, false, false));
+  assertAction('L', DECISION_RECORDED, act(true, true, false, false, false));
+  assertAction('L', DECISION_RECORDED, act(true, false, true, false, false));
+  assertAction('S', DECISION_RECORDED, act(false, true, true, false, false));
+  assertAction('S', DECISION_IGNORED, act(false, true, false, false, false));
+  assertAction('L', DECISION_FORCED, act(true, false, false, false, false));
+  assertAction('R', DECISION_FORCED, act(false, false, true, false, false));
+  assertAction('U', DECISION_RECORDED, act(false, false, false, false, false));
+}
+
+void test_right_hand_rule() {
+  assertAction('R', DECISION_RECORDED, act(true, true, true, false, true));
+  assertAction('S', DECISION_RECORDED, act(true, true, false, false, true));
+  assertAction('R', DECISION_RECORDED, act(true, false, true, false, true));
+  assertAction('R', DECISION_RECORDED, act(false, true, true, false, true));
+  assertAction('S', DECISION_IGNORED, act(false, true, false, false, true));
+  assertAction('L', DECISION_FORCED, act(true, false, false, false, true));
+  assertAction('U', DECISION_RECORDED, act(false, false, false, false, true));
+}
+
+void test_finish_needs_every_sensor() {
+  assertAction('F', DECISION_IGNORED, act(true, true, true, true, false));
+  assertAction('F', DECISION_IGNORED, act(true, true, true, true, true));
+  //on the pad with a branch unseen it is a junction like any other
+  assertAction('L', DECISION_RECORDED, act(true, true, false, true, false));
+  assertAction('R', DECISION_RECORDED, act(false, true, true, true, true));
+}
+
+//==================== Decision History ==========================
+
+void test_store_appends() {
+  char path[4];
+  int count = -1;
+  TEST_ASSERT_TRUE(maze::storeDecision(path, count, 4, 'L'));
+  TEST_ASSERT_TRUE(maze::storeDecision(path, count, 4, 'U'));
+  TEST_ASSERT_EQUAL_INT(1, count);
+  TEST_ASSERT_EQUAL_STRING_LEN("LU", path, 2);
+}
+
+void test_store_stops_at_capacity() {
+  char path[5] = {0, 0, 0, 0, 'x'};
+  int count = -1;
+  for (uint8_t i = 0; i < 4; i++) {
+    TEST_ASSERT_TRUE(maze::storeDecision(path, count, 4, 'S'));
+  }
+  TEST_ASSERT_FALSE(maze::storeDecision(path, count, 4, 'R'));
+  TEST_ASSERT_EQUAL_INT(3, count);
+  TEST_ASSERT_EQUAL_CHAR('x', path[4]);
+}
+
+//==================== Path Optimization =========================
+
+void test_optimize_single_detours() {
+  assertOptimized("LUL", "S");
+  assertOptimized("LUS", "R");
+  assertOptimized("RUL", "U");
+  assertOptimized("SUL", "R");
+  assertOptimized("SUS", "U");
+}
+
+void test_optimize_nested_detours() {
+  //L(LUL)UR: LUL gives S, which leaves the detour SUR, which gives L
+  assertOptimized("LLULUR", "LL");
+  assertOptimized("SLULUL", "SR");
+}
+
+void test_optimize_second_pass_reads_only_the_reduced_path() {
+  //the first pass leaves RUR in a five-entry array; a second pass over
+  //the old length used to read the stale tail and give SUR
+  assertOptimized("SULUR", "S");
+}
+
+void test_optimize_leaves_unreducible_paths() {
+  assertOptimized("LSR", "LSR");
+  assertOptimized("LU", "LU");
+  assertOptimized("UL", "UL");
+}
+
+void test_optimize_empty_path() {
+  char in[1];
+  char out[1];
+  int count = -1;
+  maze::optimizePath(in, out, count);
+  TEST_ASSERT_EQUAL_INT(-1, count);
+}
+
+//==================== Route Turns ===============================
+
+void test_route_turn_both_ways() {
+  const char path[] = "LSR";
+  TEST_ASSERT_EQUAL_CHAR('L', maze::routeTurn(path, 2, 0, false));
+  TEST_ASSERT_EQUAL_CHAR('R', maze::routeTurn(path, 2, 2, false));
+  //driven from the finish: last turn first, mirrored
+  TEST_ASSERT_EQUAL_CHAR('L', maze::routeTurn(path, 2, 0, true));
+  TEST_ASSERT_EQUAL_CHAR('S', maze::routeTurn(path, 2, 1, true));
+  TEST_ASSERT_EQUAL_CHAR('R', maze::routeTurn(path, 2, 2, true));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_left_hand_rule);
+  RUN_TEST(test_right_hand_rule);
+  RUN_TEST(test_finish_needs_every_sensor);
+  RUN_TEST(test_store_appends);
+  RUN_TEST(test_store_stops_at_capacity);
+  RUN_TEST(test_optimize_single_detours);
+  RUN_TEST(test_optimize_nested_detours);
+  RUN_TEST(test_optimize_second_pass_reads_only_the_reduced_path);
+  RUN_TEST(test_optimize_leaves_unreducible_paths);
+  RUN_TEST(test_optimize_empty_path);
+  RUN_TEST(test_route_turn_both_ways);
+  return UNITY_END();
+}
@@ -0,0 +1,96 @@
+//===============================
+// test_maze_decision_bench
+// Host microbenchmarks of the MazeDecision library: the junction table
+// lookup done at every intersection, and storing and optimizing a full
+// exploration history. Times are printed, not checked, as they depend
+// on the host; compare them between builds on one machine.
+//
+//   pio test -e native -f test_maze_decision_bench -v
+//===============================
+
+#include <stdio.h>
+#include <chrono>
+#include <unity.h>
+#include <MazeDecision.h>
+
+static const int MAX_DECISIONS = 100; //as in the sketch
+static const long ROUNDS = 20000;
+
+//Keeps results alive so the timed loops are not optimized away
+static volatile uint32_t sink;
+
+void setUp() {}
+void tearDown() {}
+
+static void report(const char* what, std::chrono::steady_clock::duration t, long ops) {
+  char line[96];
+  double ns = std::chrono::duration<double, std::nano>(t).count() / ops;
+  snprintf(line, sizeof(line), "%-28s %9.1f ns/op", what, ns);
+  TEST_MESSAGE(line);
+}
+
+//Exploration-like history: runs of turns with a dead end every few
+//decisions, so optimizePath has nested detours to remove.
+static int fillHistory(char path[]) {
+  static const char pattern[] = "LSLURLUSLUL";
+  int count = -1;
+  for (int i = 0; maze::storeDecision(path, count, MAX_DECISIONS, pattern[i % (sizeof(pattern) - 1)]); i++) {}
+  return count;
+}
+
+void test_bench_junction_action() {
+  uint32_t sum = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (long r = 0; r < ROUNDS; r++) {
+    for (uint8_t code = 0; code < maze::JUNCTION_CODES; code++) {
+      JunctionAction a = maze::junctionAction(code);
+      sum += a.decision + a.kind;
+    }
+  }
+  report("junctionAction", std::chrono::steady_clock::now() - start, ROUNDS * maze::JUNCTION_CODES);
+  sink = sum;
+}
+
+void test_bench_store_decisions() {
+  char path[MAX_DECISIONS];
+  uint32_t sum = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (long r = 0; r < ROUNDS; r++) {
+    sum += fillHistory(path);
+  }
+  report("storeDecision", std::chrono::steady_clock::now() - start, ROUNDS * MAX_DECISIONS);
+  sink = sum;
+  TEST_ASSERT_EQUAL_INT(MAX_DECISIONS - 1, fillHistory(path));
+}
+
+void test_bench_optimize_full_history() {
+  char history[MAX_DECISIONS];
+  char path[MAX_DECISIONS];
+  char out[MAX_DECISIONS];
+  int full = fillHistory(history);
+  int count = 0;
+  std::chrono::steady_clock::duration t(0);
+  for (long r = 0; r < ROUNDS; r++) {
+    for (int i = 0; i <= full; i++) {
+      path[i] = history[i];
+    }
+    count = full;
+    auto start = std::chrono::steady_clock::now();
+    maze::optimizePath(path, out, count);
+    t += std::chrono::steady_clock::now() - start;
+    sink = count;
+  }
+  report("optimizePath, 100 decisions", t, ROUNDS);
+  TEST_ASSERT_TRUE(count < full);
+  for (int i = 0; i <= count; i++) {
+    TEST_ASSERT_TRUE(path[i] != 'U');
+  }
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_bench_junction_action);
+  RUN_TEST(test_bench_store_decisions);
+  RUN_TEST(test_bench_optimize_full_history);
+  return UNITY_END();
+}